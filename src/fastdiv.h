@@ -81,6 +81,51 @@ fast_rem32(uint32_t v, uint32_t div, uint64_t divinfo)
 	return v - div * fast_div32(v, div, divinfo);
 }
 
+/*
+ * Fast 64bit division and remainder, using the same method.  The 64-bit
+ * multiplier does not fit together with the shifts, so the division
+ * information is a structure.
+ *
+ *	fast_div64_t divinfo = fast_div64_init(b);
+ *	q = fast_div64(a, b, &divinfo);
+ *	r = fast_rem64(a, b, &divinfo);
+ */
+
+typedef struct {
+	uint64_t	m;
+	uint8_t		s1;
+	uint8_t		s2;
+} fast_div64_t;
+
+static inline fast_div64_t
+fast_div64_init(uint64_t div)
+{
+	const int l = fls64(div - 1);
+	const unsigned __int128 mt =
+	    ((unsigned __int128)1 << 64) * (((unsigned __int128)1 << l) - div);
+	fast_div64_t divinfo;
+
+	divinfo.m = (uint64_t)(mt / div + 1);
+	divinfo.s1 = (l > 1) ? 1U : (uint8_t)l;
+	divinfo.s2 = (l == 0) ? 0 : (uint8_t)(l - 1);
+	return divinfo;
+}
+
+static inline uint64_t
+fast_div64(uint64_t v, uint64_t div, const fast_div64_t *divinfo)
+{
+	const uint64_t t = (uint64_t)
+	    (((unsigned __int128)v * divinfo->m) >> 64);
+	(void)div; // unused
+	return (t + ((v - t) >> divinfo->s1)) >> divinfo->s2;
+}
+
+static inline uint64_t
+fast_rem64(uint64_t v, uint64_t div, const fast_div64_t *divinfo)
+{
+	return v - div * fast_div64(v, div, divinfo);
+}
+
 /*
  * Common divisions (compiler will inline the constants and optimise).
  *
@@ -8,6 +8,7 @@
  *	https://github.com/aappleby/smhasher/
  */
 
+#include <string.h>
 #include <inttypes.h>
 #include "utils.h"
 
@@ -89,3 +90,62 @@ murmurhash3(const void *key, size_t len, uint32_t seed)
 
 	return h;
 }
+
+/*
+ * murmurhash64a: the 64-bit MurmurHash2 variant for the 64-bit platforms.
+ */
+uint64_t
+murmurhash64a(const void *key, size_t len, uint64_t seed)
+{
+	const uint64_t m = 0xc6a4a7935bd1e995ULL;
+	const int r = 47;
+	const uint8_t *data = key;
+	const uint8_t *end = data + (len & ~(size_t)7);
+	uint64_t h = seed ^ (len * m);
+
+	while (data != end) {
+		uint64_t k;
+
+		memcpy(&k, data, sizeof(k));
+		k = htole64(k);
+
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+
+		h ^= k;
+		h *= m;
+
+		data += sizeof(uint64_t);
+	}
+
+	switch (len & 7) {
+	case 7:
+		h ^= (uint64_t)data[6] << 48;
+		/* FALLTHROUGH */
+	case 6:
+		h ^= (uint64_t)data[5] << 40;
+		/* FALLTHROUGH */
+	case 5:
+		h ^= (uint64_t)data[4] << 32;
+		/* FALLTHROUGH */
+	case 4:
+		h ^= (uint64_t)data[3] << 24;
+		/* FALLTHROUGH */
+	case 3:
+		h ^= (uint64_t)data[2] << 16;
+		/* FALLTHROUGH */
+	case 2:
+		h ^= (uint64_t)data[1] << 8;
+		/* FALLTHROUGH */
+	case 1:
+		h ^= (uint64_t)data[0];
+		h *= m;
+	}
+
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+
+	return h;
+}
@@ -21,427 +21,3542 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include <assert.h>
 
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
 #include "rhashmap.h"
 #include "fastdiv.h"
+#include "simd.h"
 #include "utils.h"
 
+/*
+ * The default growth policy: double the size, but by no more than
+ * MAX_GROWTH_STEP buckets; grow above ~85% and shrink below ~40% fill.
+ * The load factors are kept in the 1/1024 units (see LOAD_LIMIT).
+ */
 #define	MAX_GROWTH_STEP		(1024U * 1024)
+#define	DEF_GROWTH		200
+#define	DEF_MAX_LOAD		85
+#define	DEF_MIN_LOAD		40
 
-#define	APPROX_85_PERCENT(x)	(((x) * 870) >> 10)
-#define	APPROX_40_PERCENT(x)	(((x) * 409) >> 10)
+#define	LOAD_UNITS(pct)		((pct) * 1024U / 100)
+#define	LOAD_LIMIT(x, load)	(((size_t)(x) * (load)) >> 10)
 
-typedef struct {
-	void *		key;
-	void *		val;
-	uint64_t	hash	: 32;
-	uint64_t	psl	: 16;
-	uint64_t	len	: 16;
-} rh_bucket_t;
+/*
+ * Control bytes: a separate array of one byte per bucket, which is
+ * scanned on lookup before touching the buckets themselves.  An empty
+ * bucket has a zero control byte; otherwise, the high bit is set and
+ * the lower seven bits hold a fingerprint of the hash.  The array has
+ * CTRL_GROUP_SIZE - 1 extra (always empty) bytes at the end, so that
+ * a group can be loaded at any bucket index.
+ */
+#define	CTRL_EMPTY		0x00
+#define	CTRL_FULL		0x80
+#define	CTRL_FP_MASK		0x7f
+#define	CTRL_LEN(n)		((n) + CTRL_GROUP_SIZE - 1)
 
-struct rhashmap {
-	unsigned	size;
-	unsigned	nitems;
-	unsigned	flags;
-	unsigned	minsize;
-	uint64_t	divinfo;
-	rh_bucket_t *	buckets;
-	uint64_t	hashkey;
+/*
+ * Overflow tail: the arrays have extra buckets past the end of the
+ * table, so the probe sequences never wrap around -- they run off the
+ * end of the table linearly.  The number of extra buckets is the PSL
+ * bound: if an insert would exceed it, then the table is grown.
+ */
+#define	MIN_TAIL_LEN		CTRL_GROUP_SIZE
+#define	TAIL_LEN(n)		MAX(MIN_TAIL_LEN, 4U * (unsigned)fls64(n))
 
-	/*
-	 * Small optimisation for a single element case: allocate one
-	 * bucket together with the hashmap structure -- it will generally
-	 * fit within the same cache-line.
-	 */
-	rh_bucket_t	init_bucket;
-};
+/*
+ * The default minimum size: the tail is allocated anyway, so a smaller
+ * table would not save much, but would be grown several times in a row.
+ */
+#define	DEF_MIN_SIZE		MIN_TAIL_LEN
 
-static inline uint32_t __attribute__((always_inline))
-compute_hash(const rhashmap_t *hmap, const void *key, const size_t len)
-{
-	/*
-	 * Avoiding the use function pointers here; test and call relying
-	 * on branch predictors provides a better performance.
-	 */
-	if (hmap->flags & RHM_NONCRYPTO) {
-		return murmurhash3(key, len, hmap->hashkey);
-	}
-	return halfsiphash(key, len, hmap->hashkey);
-}
+/*
+ * Incremental resize: the number of the old buckets to migrate on each
+ * operation is computed so that the migration would complete in about
+ * half of the operations the new table can take before it needs to be
+ * resized again; but not less than MIN_RESIZE_STEP.
+ */
+#define	MIN_RESIZE_STEP		8
 
-static int __attribute__((__unused__))
-validate_psl_p(rhashmap_t *hmap, const rh_bucket_t *bucket, unsigned i)
-{
-	unsigned base_i = fast_rem32(bucket->hash, hmap->size, hmap->divinfo);
-	unsigned diff = (base_i > i) ? hmap->size - base_i + i : i - base_i;
-	return bucket->key == NULL || diff == bucket->psl;
-}
+/*
+ * Background resize: the smaller tables are resized synchronously, as
+ * it is cheaper than starting a thread.
+ */
+#define	MIN_BG_RESIZE		1024
 
 /*
- * rhashmap_get: lookup an value given the key.
- *
- * => If key is present, return its associated value; otherwise NULL.
+ * Parallel resize: the tables of at least MIN_PAR_RESIZE buckets per
+ * thread are rebuilt using up to the given number of threads (but not
+ * more than MAX_RESIZE_THREADS).
  */
-void *
-rhashmap_get(rhashmap_t *hmap, const void *key, size_t len)
-{
-	const uint32_t hash = compute_hash(hmap, key, len);
-	unsigned n = 0, i = fast_rem32(hash, hmap->size, hmap->divinfo);
-	rh_bucket_t *bucket;
+#define	MIN_PAR_RESIZE		(64U * 1024)
+#define	MAX_RESIZE_THREADS	64
 
-	ASSERT(key != NULL);
-	ASSERT(len != 0);
+/*
+ * Memory of the arrays: a single allocation, with each array aligned
+ * to the cache-line size.  In the RHM_HUGEPAGE mode, the allocations
+ * of at least the huge page size are backed by the huge pages.
+ */
+#define	CACHE_LINE_SIZE		64
+#define	HUGE_PAGE_SIZE		(2UL * 1024 * 1024)
 
-	/*
-	 * Lookup is a linear probe.
-	 */
-probe:
-	bucket = &hmap->buckets[i];
-	ASSERT(validate_psl_p(hmap, bucket, i));
+/*
+ * NUMA: in the RHM_NUMA mode, the allocations of at least NUMA_MIN_LEN
+ * bytes are mapped directly and their pages are interleaved across the
+ * memory nodes (up to NUMA_MAX_NODES), so that the lookups from all nodes
+ * see the same average latency and the memory bandwidth of all nodes is
+ * used.  The smaller tables are expected to stay in the caches.
+ */
+#define	NUMA_MIN_LEN		HUGE_PAGE_SIZE
+#define	NUMA_MAX_NODES		1024
 
-	if (bucket->hash == hash && bucket->len == len &&
-	    memcmp(bucket->key, key, len) == 0) {
-		return bucket->val;
-	}
+/*
+ * Clearing the table: the arrays of at least MIN_MADV_ZERO bytes are
+ * zeroed by releasing their pages, rather than writing them.
+ */
+#define	MIN_MADV_ZERO		(16UL * 1024 * 1024)
+
+/*
+ * Key storage: the copied keys of up to INLINE_KEY_LEN bytes are stored
+ * directly in the bucket, so there is neither an allocation on insert,
+ * nor a second cache miss on a successful lookup.  The longer keys are
+ * referenced by a pointer, but their first KEY_PREFIX_LEN bytes are kept
+ * in the bucket, so that most of the mismatches can be rejected without
+ * dereferencing the pointer.  This costs 8 bytes per bucket over a plain
+ * pointer.  The keys are never inline in the RHM_NOCOPY and RHM_INTERN
+ * modes, so their buckets hold just the pointer (the ptr member only).
+ * The sets have a key slot of the pointer size: the keys of up to eight
+ * bytes are stored in it, otherwise it holds the pointer.
+ */
+#define	INLINE_KEY_LEN		16
+#define	KEY_PREFIX_LEN		8
+
+typedef union {
+	uint8_t		data[INLINE_KEY_LEN];
+	uint64_t	u64;
+	struct {
+		void *	ptr;
+		uint8_t	prefix[KEY_PREFIX_LEN];
+	} ext;
+} rh_key_t;
+
+/*
+ * Key arena: the longer key copies, of up to ARENA_MAX_KEY bytes, are
+ * allocated from the chunks owned by the map, rather than one by one.
+ * The space of a key is rounded up to its size class (the multiple of
+ * ARENA_ALIGN bytes) and bumped off the current chunk; the freed space
+ * is kept on the free list of the class for reuse.  The chunks grow
+ * from ARENA_MIN_CHUNK to ARENA_MAX_CHUNK bytes.  The keys above
+ * ARENA_MAX_KEY bytes are still allocated one by one.
+ */
+#define	ARENA_ALIGN		8
+#define	ARENA_MAX_KEY		256
+#define	ARENA_NCLASSES		(ARENA_MAX_KEY / ARENA_ALIGN)
+#define	ARENA_CLASS(len)	(((len) - 1) / ARENA_ALIGN)
+#define	ARENA_CLASS_SIZE(c)	(((c) + 1) * ARENA_ALIGN)
+#define	ARENA_MIN_CHUNK		(4U * 1024)
+#define	ARENA_MAX_CHUNK		(256U * 1024)
+
+typedef struct rh_chunk {
+	struct rh_chunk *next;
+	size_t		len;
+	uint8_t		data[];
+} rh_chunk_t;
+
+typedef struct {
+	rh_chunk_t *	chunks;
+	uint8_t *	cur;
+	uint8_t *	end;
+	size_t		chunklen;
+	size_t		nlarge;
+	size_t		nkeys;
+	size_t		nbytes;
+	void *		freelist[ARENA_NCLASSES];
 
 	/*
-	 * Stop probing if we hit an empty bucket; also, if we hit a
-	 * bucket with PSL lower than the distance from the base location,
-	 * then it means that we found the "rich" bucket which should
-	 * have been captured, if the key was inserted -- see the central
-	 * point of the algorithm in the insertion function.
+	 * The key compaction in progress (see rhashmap_compact_keys()):
+	 * the old chunks, sorted by the address, the number of the keys
+	 * still in them and the position of the pass over the buckets.
 	 */
-	if (!bucket->key || n > bucket->psl) {
-		return NULL;
-	}
-	n++;
+	rh_chunk_t **	oldchunks;
+	size_t		noldchunks;
+	size_t		noldkeys;
+	size_t		cursor;
+} rh_arena_t;
 
-	/* Continue to the next bucket. */
-	i = fast_rem32(i + 1, hmap->size, hmap->divinfo);
-	goto probe;
-}
+/*
+ * The buckets are split into parallel arrays (structure of arrays):
+ *
+ * - The metadata array holds the fields needed for probing: the hash,
+ *   PSL and the key length.  It is dense: eight buckets per cache-line.
+ *
+ * - The key array is accessed only on a candidate match (or when the
+ *   entries are moved).  The 64-bit integer keys, the key pointers
+ *   (RHM_NOCOPY and RHM_INTERN) and the keys of the sets take 8 bytes per
+ *   bucket, i.e. only the first member of rh_key_t; the other keys take 16.
+ *
+ * - The value array holds the values: either the value pointers or, if
+ *   the map was created with a value size, the values themselves (by
+ *   copy).  The sets have no values, hence they have no value array.
+ *
+ * A bucket is empty if its length is zero.
+ *
+ * The metadata is compact (8 bytes) by default, which limits the table
+ * to UINT_MAX buckets and the keys to 64 KB.  The RHM_WIDE maps use the
+ * wide metadata (16 bytes), holding the full 64-bit hash, and 64-bit
+ * sizes.  The metadata is accessed using the meta_*() routines.
+ */
+typedef struct {
+	uint32_t	hash;
+	uint16_t	psl;
+	uint16_t	len;
+} rh_meta_t;
+
+typedef struct {
+	uint64_t	hash;
+	uint32_t	psl;
+	uint32_t	len;
+} rh_wmeta_t;
+
+#define	RH_NOTFOUND		SIZE_MAX
 
 /*
- * rhashmap_insert: internal rhashmap_put(), without the resize.
+ * Internal flags: the map of 64-bit integer keys (see rhashmap_u64_*),
+ * the set, i.e. a map without values (see rhashset_*), and the map of
+ * the values stored by copy (see rhashmap_v*).
  */
-static void *
-rhashmap_insert(rhashmap_t *hmap, const void *key, size_t len, void *val)
-{
-	const uint32_t hash = compute_hash(hmap, key, len);
-	rh_bucket_t *bucket, entry;
-	unsigned i;
+#define	RHM_U64KEY		0x80000000U
+#define	RHM_NOVAL		0x40000000U
+#define	RHM_VALCOPY		0x20000000U
 
-	ASSERT(key != NULL);
-	ASSERT(len != 0);
+static inline void	rhashmap_step(rhashmap_t *);
+static void		rhashmap_remove_at(rhashmap_t *, size_t, void *);
+static void		rhashmap_bg_replay(rhashmap_t *, size_t);
+static void		rhashmap_bg_finish(rhashmap_t *);
+static void		rhashmap_bg_switch(rhashmap_t *);
+
+struct rhashmap {
+	size_t		size;
+	size_t		nitems;
+	unsigned	flags;
+	size_t		minsize;
+	size_t		growstep;
+	unsigned	growth;
+	unsigned	maxload;
+	unsigned	minload;
+	size_t		shrinkdelay;
+	size_t		ndeleted;
+	unsigned	tail;
+	uint64_t	divinfo;
+	fast_div64_t	wdivinfo;
+	void *		meta;
+	uint8_t *	keys;
+	uint8_t *	vals;
+	uint8_t *	ctrl;
+	unsigned	metasize;
+	unsigned	keysize;
+	unsigned	inlinelen;
+	size_t		valsize;
+	unsigned	maxpsl;
+	uint64_t	hashkey;
+
+	/* The maximum number of resize threads (see rhashmap_par_resize()). */
+	unsigned	nthreads;
 
 	/*
-	 * Setup the bucket entry.
+	 * The incremental resize (see rhashmap_resize_start()): the old
+	 * table, if the migration is in progress, and the number of its
+	 * buckets to migrate per operation.  In the old table, the number
+	 * of buckets already migrated, i.e. the buckets to ignore.
 	 */
-	if ((hmap->flags & RHM_NOCOPY) == 0) {
-		if ((entry.key = malloc(len)) == NULL) {
-			return NULL;
-		}
-		memcpy(entry.key, key, len);
-	} else {
-		entry.key = (void *)(uintptr_t)key;
-	}
-	entry.hash = hash;
-	entry.len = len;
-	entry.val = val;
-	entry.psl = 0;
+	rhashmap_t *	old;
+	size_t		resize_step;
+	size_t		migrated;
+
+	/* The background resize in progress (see rhashmap_bg_start()). */
+	struct rh_bgresize *bg;
+
+	/* The memory block of the arrays (see rhashmap_mem_alloc()). */
+	void *		mem;
+	size_t		memlen;
+	bool		mmapped;
 
 	/*
-	 * From the paper: "when inserting, if a record probes a location
-	 * that is already occupied, the record that has traveled longer
-	 * in its probe sequence keeps the location, and the other one
-	 * continues on its probe sequence" (page 12).
-	 *
-	 * Basically: if the probe sequence length (PSL) of the element
-	 * being inserted is greater than PSL of the element in the bucket,
-	 * then swap them and continue.
+	 * The key arena (see key_alloc()), allocated with the first key
+	 * copy.  It is shared by the old and the current tables.
 	 */
-	i = fast_rem32(hash, hmap->size, hmap->divinfo);
-probe:
-	bucket = &hmap->buckets[i];
-	if (bucket->key) {
-		ASSERT(validate_psl_p(hmap, bucket, i));
-
-		/*
-		 * There is a key in the bucket.
-		 */
-		if (bucket->hash == hash && bucket->len == len &&
-		    memcmp(bucket->key, key, len) == 0) {
-			/* Duplicate key: return the current value. */
-			if ((hmap->flags & RHM_NOCOPY) == 0) {
-				free(entry.key);
-			}
-			return bucket->val;
-		}
+	rh_arena_t *	arena;
 
-		/*
-		 * We found a "rich" bucket.  Capture its location.
-		 */
-		if (entry.psl > bucket->psl) {
-			rh_bucket_t tmp;
+	/* The memory allocator (see rhashmap_create_ex()). */
+	const rhashmap_allocator_t *alloc;
+};
 
-			/*
-			 * Place our key-value pair by swapping the "rich"
-			 * bucket with our entry.  Copy the structures.
-			 */
-			tmp = entry;
-			entry = *bucket;
-			*bucket = tmp;
-		}
-		entry.psl++;
+/*
+ * Background resize (RHM_BACKGROUND): the new table is built by a helper
+ * thread from the old table, which is frozen (read-only) meanwhile.  The
+ * inserts go to the current table (the log) and the deletes of the keys
+ * in the old table are recorded as the tombstones; both are replayed into
+ * the new table once it is built.  The deletes are replayed incrementally,
+ * a number of the tombstone buckets per operation (see rhashmap_bg_replay()).
+ */
+typedef struct rh_bgresize {
+	pthread_t	thread;
+	atomic_bool	done;
+	int		error;
+	size_t		newsize;
+	rhashmap_t	table;
+	rhashset_t *	tombs;
 
-		/* Continue to the next bucket. */
-		ASSERT(validate_psl_p(hmap, bucket, i));
-		i = fast_rem32(i + 1, hmap->size, hmap->divinfo);
-		goto probe;
-	}
+	/* The replay of the deletes, once the thread is joined. */
+	bool		joined;
+	size_t		cursor;
+	size_t		step;
+} rh_bgresize_t;
 
-	/*
-	 * Found a free bucket: insert the entry.
-	 */
-	*bucket = entry; // copy
-	hmap->nitems++;
+/*
+ * The default memory allocator: the C library.  The large bucket arrays
+ * in the RHM_HUGEPAGE mode are mapped directly (see mmap_huge()).
+ */
+static void *
+std_alloc(size_t len, void *arg)
+{
+	(void)arg;
+	return malloc(len);
+}
 
-	ASSERT(validate_psl_p(hmap, bucket, i));
-	return val;
+static void *
+std_zalloc(size_t len, void *arg)
+{
+	(void)arg;
+	return calloc(1, len);
 }
 
-static int
-rhashmap_resize(rhashmap_t *hmap, size_t newsize)
+static void
+std_free(void *ptr, size_t len, void *arg)
 {
-	const size_t len = newsize * sizeof(rh_bucket_t);
-	rh_bucket_t *oldbuckets = hmap->buckets;
-	const size_t oldsize = hmap->size;
-	rh_bucket_t *newbuckets;
+	(void)len; (void)arg;
+	free(ptr);
+}
 
-	ASSERT(newsize > 0);
-	ASSERT(newsize > hmap->nitems);
+static void *
+std_realloc(void *ptr, size_t oldlen, size_t len, void *arg)
+{
+	(void)oldlen; (void)arg;
+	return realloc(ptr, len);
+}
 
-	/*
-	 * Check for an overflow and allocate buckets.  Also, generate
-	 * a new hash key/seed every time we resize the hash table.
-	 */
-	if (newsize == 1) {
-		memset(&hmap->init_bucket, 0, sizeof(rh_bucket_t));
-		newbuckets = &hmap->init_bucket;
-	} else if (newsize > UINT_MAX) {
-		return -1;
-	} else if ((newbuckets = calloc(1, len)) == NULL) {
-		return -1;
-	}
-	hmap->buckets = newbuckets;
-	hmap->size = newsize;
-	hmap->nitems = 0;
+static const rhashmap_allocator_t std_allocator = {
+	.alloc		= std_alloc,
+	.zalloc		= std_zalloc,
+	.free		= std_free,
+	.realloc	= std_realloc,
+};
 
-	hmap->divinfo = fast_div32_init(newsize);
-	hmap->hashkey ^= random() | (random() << 32);
+/*
+ * rh_alloc, rh_zalloc, rh_free: allocate, allocate zeroed and free the
+ * memory using the allocator of the hash map.
+ */
+static inline void *
+rh_alloc(const rhashmap_t *hmap, size_t len)
+{
+	return hmap->alloc->alloc(len, hmap->alloc->arg);
+}
 
-	for (unsigned i = 0; i < oldsize; i++) {
-		const rh_bucket_t *bucket = &oldbuckets[i];
+static inline void *
+rh_zalloc(const rhashmap_t *hmap, size_t len)
+{
+	return hmap->alloc->zalloc(len, hmap->alloc->arg);
+}
 
-		/* Skip the empty buckets. */
-		if (!bucket->key) {
-			continue;
-		}
-		rhashmap_insert(hmap, bucket->key, bucket->len, bucket->val);
-		if ((hmap->flags & RHM_NOCOPY) == 0) {
-			free(bucket->key);
-		}
-	}
-	if (oldbuckets && oldbuckets != &hmap->init_bucket) {
-		free(oldbuckets);
+static inline void
+rh_free(const rhashmap_t *hmap, void *ptr, size_t len)
+{
+	if (ptr) {
+		hmap->alloc->free(ptr, len, hmap->alloc->arg);
 	}
-	return 0;
 }
 
 /*
- * rhashmap_put: insert a value given the key.
+ * rh_realloc: resize the memory block, preserving its contents; if the
+ * allocator has no realloc routine, then allocate a new block and copy.
  *
- * => If the key is already present, return its associated value.
- * => Otherwise, on successful insert, return the given value.
+ * => Returns NULL on failure, in which case the block is not changed.
  */
-void *
-rhashmap_put(rhashmap_t *hmap, const void *key, size_t len, void *val)
+static void *
+rh_realloc(const rhashmap_t *hmap, void *ptr, size_t oldlen, size_t len)
 {
-	const size_t threshold = APPROX_85_PERCENT(hmap->size);
+	const rhashmap_allocator_t *alloc = hmap->alloc;
+	void *nptr;
 
-	/*
-	 * If the load factor is more than the threshold, then resize.
-	 */
-	if (__predict_false(hmap->nitems > threshold)) {
-		/*
-		 * Grow the hash table by doubling its size, but with
-		 * a limit of MAX_GROWTH_STEP.
-		 */
-		const size_t grow_limit = hmap->size + MAX_GROWTH_STEP;
-		const size_t newsize = MIN(hmap->size << 1, grow_limit);
-		if (rhashmap_resize(hmap, newsize) != 0) {
-			return NULL;
-		}
+	if (alloc->realloc) {
+		return alloc->realloc(ptr, oldlen, len, alloc->arg);
+	}
+	if ((nptr = alloc->alloc(len, alloc->arg)) != NULL) {
+		memcpy(nptr, ptr, MIN(oldlen, len));
+		alloc->free(ptr, oldlen, alloc->arg);
 	}
+	return nptr;
+}
+
+/*
+ * hash_u64: hash the 64-bit integer key using the multiply-xorshift
+ * mixer (the MurmurHash3 64-bit finaliser), seeded with the hash key.
+ */
+static inline uint64_t
+hash_u64(const rhashmap_t *hmap, uint64_t key)
+{
+	uint64_t h = key ^ hmap->hashkey;
 
-	return rhashmap_insert(hmap, key, len, val);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
 }
 
 /*
- * rhashmap_del: remove the given key and return its value.
+ * compute_hash: compute the hash of the key.
  *
- * => If key was present, return its associated value; otherwise NULL.
+ * => The hash is 64-bit in the RHM_WIDE maps and 32-bit otherwise.
  */
-void *
-rhashmap_del(rhashmap_t *hmap, const void *key, size_t len)
+static inline uint64_t __attribute__((always_inline))
+compute_hash(const rhashmap_t *hmap, const void *key, const size_t len)
 {
-	const size_t threshold = APPROX_40_PERCENT(hmap->size);
-	const uint32_t hash = compute_hash(hmap, key, len);
-	unsigned n = 0, i = fast_rem32(hash, hmap->size, hmap->divinfo);
-	rh_bucket_t *bucket;
-	void *val;
+	const bool wide = (hmap->flags & RHM_WIDE) != 0;
 
-	ASSERT(key != NULL);
-	ASSERT(len != 0);
-probe:
 	/*
-	 * The same probing logic as in the lookup function.
+	 * Avoiding the use function pointers here; test and call relying
+	 * on branch predictors provides a better performance.
 	 */
-	bucket = &hmap->buckets[i];
-	if (!bucket->key || n > bucket->psl) {
-		return NULL;
-	}
-	ASSERT(validate_psl_p(hmap, bucket, i));
+	if (hmap->flags & RHM_U64KEY) {
+		uint64_t k, h;
 
-	if (bucket->hash != hash || bucket->len != len ||
-	    memcmp(bucket->key, key, len) != 0) {
-		/* Continue to the next bucket. */
-		i = fast_rem32(i + 1, hmap->size, hmap->divinfo);
-		n++;
-		goto probe;
+		ASSERT(len == sizeof(uint64_t));
+		memcpy(&k, key, sizeof(k));
+		h = hash_u64(hmap, k);
+		return wide ? h : (uint32_t)h;
 	}
-
-	/*
-	 * Free the bucket.
-	 */
-	if ((hmap->flags & RHM_NOCOPY) == 0) {
-		free(bucket->key);
+	if (hmap->flags & RHM_NONCRYPTO) {
+		return wide ? murmurhash64a(key, len, hmap->hashkey) :
+		    murmurhash3(key, len, hmap->hashkey);
 	}
-	val = bucket->val;
-	hmap->nitems--;
-
-	/*
-	 * The probe sequence must be preserved in the deletion case.
-	 * Use the backwards-shifting method to maintain low variance.
-	 */
-	for (;;) {
-		rh_bucket_t *nbucket;
+	return wide ? siphash24(key, len, hmap->hashkey) :
+	    halfsiphash(key, len, hmap->hashkey);
+}
 
-		bucket->key = NULL;
-		bucket->len = 0;
+/*
+ * key_inline_p: return true if the key of given length is stored inline.
+ *
+ * => In the RHM_INTERN mode, the keys are never inline: their copies
+ *    must stay at the same address.
+ */
+static inline bool
+key_inline_p(const rhashmap_t *hmap, const size_t len)
+{
+	return len <= hmap->inlinelen;
+}
 
-		i = fast_rem32(i + 1, hmap->size, hmap->divinfo);
-		nbucket = &hmap->buckets[i];
-		ASSERT(validate_psl_p(hmap, nbucket, i));
+/*
+ * key_prefix_p: return true if the key prefix is kept in the bucket,
+ * along with the pointer to a key which is not stored inline.
+ */
+static inline bool
+key_prefix_p(const rhashmap_t *hmap)
+{
+	return hmap->keysize == sizeof(rh_key_t);
+}
 
-		/*
-		 * Stop if we reach an empty bucket or hit a key which
-		 * is in its base (original) location.
-		 */
-		if (!nbucket->key || nbucket->psl == 0) {
-			break;
-		}
+/*
+ * meta_hash, meta_psl, meta_len: return the hash, PSL and the key length
+ * of the given bucket.
+ */
+static inline uint64_t
+meta_hash(const rhashmap_t *hmap, size_t i)
+{
+	if (hmap->flags & RHM_WIDE) {
+		return ((const rh_wmeta_t *)hmap->meta)[i].hash;
+	}
+	return ((const rh_meta_t *)hmap->meta)[i].hash;
+}
 
-		nbucket->psl--;
-		*bucket = *nbucket;
-		bucket = nbucket;
+static inline unsigned
+meta_psl(const rhashmap_t *hmap, size_t i)
+{
+	if (hmap->flags & RHM_WIDE) {
+		return ((const rh_wmeta_t *)hmap->meta)[i].psl;
 	}
+	return ((const rh_meta_t *)hmap->meta)[i].psl;
+}
 
-	/*
-	 * If the load factor is less than threshold, then shrink by
-	 * halving the size, but not more than the minimum size.
-	 */
-	if (hmap->nitems > hmap->minsize && hmap->nitems < threshold) {
-		size_t newsize = MAX(hmap->size >> 1, hmap->minsize);
-		(void)rhashmap_resize(hmap, newsize);
+static inline size_t
+meta_len(const rhashmap_t *hmap, size_t i)
+{
+	if (hmap->flags & RHM_WIDE) {
+		return ((const rh_wmeta_t *)hmap->meta)[i].len;
 	}
-	return val;
+	return ((const rh_meta_t *)hmap->meta)[i].len;
 }
 
-void *
-rhashmap_walk(rhashmap_t *hmap, uintmax_t *iter, size_t *lenp, void **valp)
+/*
+ * meta_empty_p: return true if the bucket has no key.
+ */
+static inline bool
+meta_empty_p(const rhashmap_t *hmap, size_t i)
 {
-	const unsigned hmap_size = hmap->size;
-	unsigned i = *iter;
+	return meta_len(hmap, i) == 0;
+}
 
-	while (i < hmap_size) {
-		rh_bucket_t *bucket = &hmap->buckets[i];
+/*
+ * meta_set: set the metadata of the given bucket.
+ */
+static inline void
+meta_set(rhashmap_t *hmap, size_t i, uint64_t hash, unsigned psl, size_t len)
+{
+	if (hmap->flags & RHM_WIDE) {
+		rh_wmeta_t *meta = &((rh_wmeta_t *)hmap->meta)[i];
 
-		i++; // next
-		if (!bucket->key) {
-			continue;
-		}
-		*iter = i;
-		if (lenp) {
-			*lenp = bucket->len;
-		}
-		if (valp) {
-			*valp = bucket->val;
-		}
-		return bucket->key;
+		meta->hash = hash;
+		meta->psl = psl;
+		meta->len = len;
+	} else {
+		rh_meta_t *meta = &((rh_meta_t *)hmap->meta)[i];
+
+		meta->hash = (uint32_t)hash;
+		meta->psl = psl;
+		meta->len = len;
 	}
-	return NULL;
 }
 
 /*
- * rhashmap_create: construct a new hash table.
- *
- * => If size is non-zero, then pre-allocate the given number of buckets;
- * => If size is zero, then a default minimum is used.
+ * meta_set_psl: set the PSL of the given bucket.
  */
-rhashmap_t *
-rhashmap_create(size_t size, unsigned flags)
+static inline void
+meta_set_psl(rhashmap_t *hmap, size_t i, unsigned psl)
 {
-	rhashmap_t *hmap;
-
-	hmap = calloc(1, sizeof(rhashmap_t));
-	if (!hmap) {
-		return NULL;
-	}
-	hmap->flags = flags;
-	hmap->minsize = MAX(size, 1);
-	if (rhashmap_resize(hmap, hmap->minsize) != 0) {
-		free(hmap);
-		return NULL;
+	if (hmap->flags & RHM_WIDE) {
+		((rh_wmeta_t *)hmap->meta)[i].psl = psl;
+	} else {
+		((rh_meta_t *)hmap->meta)[i].psl = psl;
 	}
-	ASSERT(hmap->buckets);
-	ASSERT(hmap->size);
-	return hmap;
 }
 
 /*
- * rhashmap_destroy: free the memory used by the hash table.
- *
- * => It is the responsibility of the caller to remove elements if needed.
+ * bucket_meta: return the metadata storage of the given bucket.
  */
-void
-rhashmap_destroy(rhashmap_t *hmap)
+static inline void *
+bucket_meta(const rhashmap_t *hmap, size_t i)
+{
+	return (uint8_t *)hmap->meta + i * hmap->metasize;
+}
+
+/*
+ * bucket_key: return the key storage of the given bucket.
+ *
+ * => In the maps of 64-bit integer keys, only the u64 member is valid.
+ */
+static inline rh_key_t *
+bucket_key(const rhashmap_t *hmap, size_t i)
+{
+	return (void *)(hmap->keys + (size_t)i * hmap->keysize);
+}
+
+/*
+ * bucket_val: return the value storage of the given bucket.
+ */
+static inline void *
+bucket_val(const rhashmap_t *hmap, size_t i)
+{
+	ASSERT(hmap->valsize != 0);
+	return hmap->vals + (size_t)i * hmap->valsize;
+}
+
+/*
+ * bucket_ptr: return the value pointer of the given bucket.
+ */
+static inline void *
+bucket_ptr(const rhashmap_t *hmap, size_t i)
+{
+	ASSERT((hmap->flags & (RHM_NOVAL | RHM_VALCOPY)) == 0);
+	return ((void **)(void *)hmap->vals)[i];
+}
+
+/*
+ * key_data: return the pointer to the key (of a given length) stored
+ * in the key storage.
+ */
+static inline void *
+key_data(const rhashmap_t *hmap, rh_key_t *rk, const size_t len)
+{
+	if (key_inline_p(hmap, len)) {
+		return rk->data;
+	}
+	return rk->ext.ptr;
+}
+
+/*
+ * key_eq: return true if the stored key matches the given key of the
+ * given length (which must be already matching).
+ */
+static inline bool
+key_eq(const rhashmap_t *hmap, const rh_key_t *rk,
+    const void *key, const size_t len)
+{
+	const unsigned plen = MIN(len, KEY_PREFIX_LEN);
+
+	if (hmap->flags & RHM_U64KEY) {
+		uint64_t k;
+
+		/* Integer keys: just compare the integers. */
+		memcpy(&k, key, sizeof(k));
+		return rk->u64 == k;
+	}
+	if (key_inline_p(hmap, len)) {
+		return memcmp(rk->data, key, len) == 0;
+	}
+	if (!key_prefix_p(hmap)) {
+		return memcmp(rk->ext.ptr, key, len) == 0;
+	}
+	if (memcmp(rk->ext.prefix, key, plen) != 0) {
+		return false;
+	}
+	return len == plen || memcmp((const uint8_t *)rk->ext.ptr +
+	    plen, (const uint8_t *)key + plen, len - plen) == 0;
+}
+
+/*
+ * key_alloc: allocate the space for a key copy of the given length
+ * (which is not stored inline) from the key arena.
+ *
+ * => Allocates the arena itself on the first use.
+ */
+static void *
+key_alloc(rhashmap_t *hmap, const size_t len)
+{
+	rh_arena_t *arena = hmap->arena;
+	size_t c, csize;
+	void *ptr;
+
+	if (__predict_false(arena == NULL)) {
+		if ((arena = rh_zalloc(hmap, sizeof(rh_arena_t))) == NULL) {
+			return NULL;
+		}
+		arena->chunklen = ARENA_MIN_CHUNK;
+		hmap->arena = arena;
+	}
+	if (__predict_false(len > ARENA_MAX_KEY)) {
+		if ((ptr = rh_alloc(hmap, len)) != NULL) {
+			arena->nlarge++;
+		}
+		return ptr;
+	}
+	c = ARENA_CLASS(len);
+	csize = ARENA_CLASS_SIZE(c);
+	if ((ptr = arena->freelist[c]) != NULL) {
+		/* Reuse the freed space; it holds the next free pointer. */
+		arena->freelist[c] = *(void **)ptr;
+	} else {
+		if (__predict_false((size_t)(arena->end - arena->cur) < csize)) {
+			/*
+			 * Start a new chunk.  The rest of the current one,
+			 * which is less than a key, is left unused.
+			 */
+			const size_t clen = arena->chunklen;
+			rh_chunk_t *chunk;
+
+			chunk = rh_alloc(hmap, sizeof(rh_chunk_t) + clen);
+			if (chunk == NULL) {
+				return NULL;
+			}
+			chunk->len = clen;
+			chunk->next = arena->chunks;
+			arena->chunks = chunk;
+			arena->cur = chunk->data;
+			arena->end = chunk->data + clen;
+			arena->chunklen = MIN(clen << 1, ARENA_MAX_CHUNK);
+		}
+		ptr = arena->cur;
+		arena->cur += csize;
+	}
+	arena->nkeys++;
+	arena->nbytes += csize;
+	return ptr;
+}
+
+/*
+ * arena_old_p: return true if the key space is in the old chunks of
+ * the key compaction in progress.
+ */
+static bool
+arena_old_p(const rh_arena_t *arena, const void *ptr)
+{
+	const uintptr_t p = (uintptr_t)ptr;
+	size_t l = 0, r = arena->noldchunks;
+	const rh_chunk_t *chunk;
+
+	/* Binary search for the last chunk starting at or below. */
+	while (r - l > 1) {
+		const size_t m = l + (r - l) / 2;
+
+		if ((uintptr_t)arena->oldchunks[m]->data <= p) {
+			l = m;
+		} else {
+			r = m;
+		}
+	}
+	chunk = arena->oldchunks[l];
+	return (uintptr_t)chunk->data <= p &&
+	    p < (uintptr_t)chunk->data + chunk->len;
+}
+
+/*
+ * key_dealloc: return the space of the key copy to the key arena.
+ */
+static void
+key_dealloc(const rhashmap_t *hmap, void *ptr, const size_t len)
+{
+	rh_arena_t *arena = hmap->arena;
+
+	if (__predict_false(len > ARENA_MAX_KEY)) {
+		arena->nlarge--;
+		rh_free(hmap, ptr, len);
+		return;
+	}
+	arena->nkeys--;
+	arena->nbytes -= ARENA_CLASS_SIZE(ARENA_CLASS(len));
+	if (__predict_false(arena->oldchunks != NULL) &&
+	    arena_old_p(arena, ptr)) {
+		/* Freed with the old chunks, once the compaction completes. */
+		arena->noldkeys--;
+		return;
+	}
+	*(void **)ptr = arena->freelist[ARENA_CLASS(len)];
+	arena->freelist[ARENA_CLASS(len)] = ptr;
+}
+
+static int
+chunk_cmp(const void *a, const void *b)
+{
+	const uintptr_t x = (uintptr_t)*(rh_chunk_t * const *)a;
+	const uintptr_t y = (uintptr_t)*(rh_chunk_t * const *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * arena_compact_start: start the key compaction: the current chunks
+ * become the old ones and the keys are allocated from the new chunks.
+ *
+ * => The free lists are emptied: the freed old space is not reused.
+ * => The new chunks are sized for the current keys (within the limit).
+ */
+static int
+arena_compact_start(const rhashmap_t *hmap)
+{
+	rh_arena_t *arena = hmap->arena;
+	rh_chunk_t **oldchunks, *chunk;
+	size_t n = 0;
+
+	ASSERT(arena->oldchunks == NULL);
+	for (chunk = arena->chunks; chunk; chunk = chunk->next) {
+		n++;
+	}
+	if ((oldchunks = rh_alloc(hmap, n * sizeof(rh_chunk_t *))) == NULL) {
+		return -1;
+	}
+	n = 0;
+	for (chunk = arena->chunks; chunk; chunk = chunk->next) {
+		oldchunks[n++] = chunk;
+	}
+	qsort(oldchunks, n, sizeof(rh_chunk_t *), chunk_cmp);
+
+	arena->oldchunks = oldchunks;
+	arena->noldchunks = n;
+	arena->noldkeys = arena->nkeys;
+	arena->cursor = 0;
+
+	arena->chunks = NULL;
+	arena->cur = arena->end = NULL;
+	arena->chunklen = MAX(ARENA_MIN_CHUNK, MIN(arena->nbytes,
+	    ARENA_MAX_CHUNK));
+	memset(arena->freelist, 0, sizeof(arena->freelist));
+	return 0;
+}
+
+/*
+ * arena_compact_end: free the old chunks of the key compaction.
+ */
+static void
+arena_compact_end(const rhashmap_t *hmap)
+{
+	rh_arena_t *arena = hmap->arena;
+
+	for (size_t i = 0; i < arena->noldchunks; i++) {
+		rh_chunk_t *chunk = arena->oldchunks[i];
+		rh_free(hmap, chunk, sizeof(rh_chunk_t) + chunk->len);
+	}
+	rh_free(hmap, arena->oldchunks,
+	    arena->noldchunks * sizeof(rh_chunk_t *));
+	arena->oldchunks = NULL;
+	arena->noldchunks = 0;
+	arena->noldkeys = 0;
+}
+
+/*
+ * arena_reset: free all of the key space, but keep the most recent
+ * (largest) chunk for the reuse.
+ *
+ * => The keys above ARENA_MAX_KEY must be already freed.
+ */
+static void
+arena_reset(const rhashmap_t *hmap)
+{
+	rh_arena_t *arena = hmap->arena;
+	rh_chunk_t *chunk = arena->chunks, *next;
+
+	ASSERT(arena->nlarge == 0);
+	if (arena->oldchunks) {
+		arena_compact_end(hmap);
+	}
+	memset(arena->freelist, 0, sizeof(arena->freelist));
+	arena->nkeys = 0;
+	arena->nbytes = 0;
+	if (chunk == NULL) {
+		return;
+	}
+	for (rh_chunk_t *c = chunk->next; c; c = next) {
+		next = c->next;
+		rh_free(hmap, c, sizeof(rh_chunk_t) + c->len);
+	}
+	chunk->next = NULL;
+	arena->cur = chunk->data;
+	arena->end = chunk->data + chunk->len;
+}
+
+/*
+ * arena_destroy: free the key arena and all of its chunks.
+ */
+static void
+arena_destroy(const rhashmap_t *hmap)
+{
+	rh_arena_t *arena = hmap->arena;
+	rh_chunk_t *chunk, *next;
+
+	if (arena == NULL) {
+		return;
+	}
+	if (arena->oldchunks) {
+		arena_compact_end(hmap);
+	}
+	for (chunk = arena->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		rh_free(hmap, chunk, sizeof(rh_chunk_t) + chunk->len);
+	}
+	rh_free(hmap, arena, sizeof(rh_arena_t));
+}
+
+/*
+ * key_set: setup the key storage, copying the key if needed.
+ */
+static int
+key_set(rhashmap_t *hmap, rh_key_t *rk, const void *key, const size_t len)
 {
+	if (key_inline_p(hmap, len)) {
+		memcpy(rk->data, key, len);
+		return 0;
+	}
 	if ((hmap->flags & RHM_NOCOPY) == 0) {
-		for (unsigned i = 0; i < hmap->size; i++) {
-			const rh_bucket_t *bucket = &hmap->buckets[i];
+		if ((rk->ext.ptr = key_alloc(hmap, len)) == NULL) {
+			return -1;
+		}
+		memcpy(rk->ext.ptr, key, len);
+	} else {
+		rk->ext.ptr = (void *)(uintptr_t)key;
+	}
+	if (key_prefix_p(hmap)) {
+		memcpy(rk->ext.prefix, key, MIN(len, KEY_PREFIX_LEN));
+	}
+	return 0;
+}
+
+/*
+ * key_free: release the key copy, if there is one.
+ */
+static inline void
+key_free(const rhashmap_t *hmap, rh_key_t *rk, const size_t len)
+{
+	if ((hmap->flags & RHM_NOCOPY) == 0 && !key_inline_p(hmap, len)) {
+		key_dealloc(hmap, rk->ext.ptr, len);
+	}
+}
+
+/*
+ * home_slot: return the base (original) location for the given hash.
+ *
+ * => For the power-of-two sizes, use the high bits of the hash (this is
+ *    Lemire's "fastrange", which reduces to a shift); otherwise, take
+ *    the remainder using the fast division.
+ * => The RHM_WIDE maps use the 64-bit hash and arithmetic.
+ */
+static inline size_t __attribute__((always_inline))
+home_slot(const rhashmap_t *hmap, uint64_t hash)
+{
+	if (hmap->flags & RHM_WIDE) {
+		if (hmap->flags & RHM_POW2) {
+			return (size_t)
+			    (((unsigned __int128)hash * hmap->size) >> 64);
+		}
+		return fast_rem64(hash, hmap->size, &hmap->wdivinfo);
+	}
+	if (hmap->flags & RHM_POW2) {
+		return (hash * hmap->size) >> 32;
+	}
+	return fast_rem32((uint32_t)hash, hmap->size, hmap->divinfo);
+}
+
+/*
+ * ctrl_byte: return the control byte for the given hash.
+ *
+ * => The fingerprint is not taken from the hash bits directly: see
+ *    ctrl_fingerprint().
+ */
+static inline uint8_t
+ctrl_byte(const rhashmap_t *hmap, uint64_t hash)
+{
+	(void)hmap;
+	return CTRL_FULL | ctrl_fingerprint(hash);
+}
+
+static int __attribute__((__unused__))
+validate_psl_p(rhashmap_t *hmap, size_t i)
+{
+	const uint64_t hash = meta_hash(hmap, i);
+	const unsigned psl = meta_psl(hmap, i);
+	const size_t base_i = home_slot(hmap, hash);
+
+	if (meta_empty_p(hmap, i)) {
+		return hmap->ctrl[i] == CTRL_EMPTY;
+	}
+	return base_i <= i && i - base_i == psl &&
+	    psl <= hmap->maxpsl && psl < hmap->tail &&
+	    hmap->ctrl[i] == ctrl_byte(hmap, hash);
+}
+
+/*
+ * rhashmap_lookup: find the bucket of the given key.
+ *
+ * => If key is present, return the bucket index; otherwise RH_NOTFOUND.
+ */
+static size_t
+rhashmap_lookup(rhashmap_t *hmap, const void *key, size_t len, uint64_t hash)
+{
+	const uint8_t fp = ctrl_byte(hmap, hash);
+	unsigned n = hmap->maxpsl + 1;
+	size_t i = home_slot(hmap, hash);
+
+	ASSERT(key != NULL);
+	ASSERT(len != 0);
+
+	if (__predict_false(i < hmap->migrated)) {
+		/*
+		 * The old table of the incremental resize: the buckets
+		 * before the migration point are gone; skip them.
+		 */
+		const size_t skip = hmap->migrated - i;
+
+		if (skip >= n) {
+			return RH_NOTFOUND;
+		}
+		n -= skip;
+		i += skip;
+	}
+
+	/*
+	 * Lookup is a linear probe.  However, rather than inspecting the
+	 * buckets one by one, scan the control bytes a group at a time:
+	 * only the buckets with a matching fingerprint are visited.
+	 *
+	 * Stop probing if we hit an empty bucket or if we exceed the
+	 * maximum PSL in the table: the key cannot be any further, as
+	 * Robin Hood insertion never places an element past it.  The
+	 * probe never wraps around (see the overflow tail), so this is
+	 * a straight scan through the memory.
+	 */
+	for (;;) {
+		const uint8_t *grp = &hmap->ctrl[i];
+		const ctrl_mask_t empty = ctrl_group_match(grp, CTRL_EMPTY);
+		ctrl_mask_t valid, match;
+
+		valid = ctrl_mask_below(n);
+		if (empty) {
+			valid &= ctrl_mask_below(ctrl_mask_first(empty));
+		}
+		match = ctrl_group_match(grp, fp) & valid;
+
+		while (match) {
+			const size_t j = i + ctrl_mask_first(match);
 
-			if (bucket->key) {
-				free(bucket->key);
+			/*
+			 * Fetch the key in parallel with the metadata:
+			 * the fingerprint matched, so it is most likely
+			 * going to be needed.
+			 */
+			__builtin_prefetch(bucket_key(hmap, j));
+			ASSERT(validate_psl_p(hmap, j));
+
+			if (meta_hash(hmap, j) == hash &&
+			    meta_len(hmap, j) == len &&
+			    key_eq(hmap, bucket_key(hmap, j), key, len)) {
+				return j;
 			}
+			match &= match - 1;
+		}
+		if (empty || n <= CTRL_GROUP_SIZE) {
+			return RH_NOTFOUND;
+		}
+		n -= CTRL_GROUP_SIZE;
+
+		/* Continue to the next group. */
+		i += CTRL_GROUP_SIZE;
+	}
+}
+
+/*
+ * tomb_p: return true if the key was deleted from the old table during
+ * the background resize.
+ */
+static bool
+tomb_p(const rhashmap_t *hmap, const void *key, size_t len)
+{
+	rhashset_t *tombs = hmap->bg->tombs;
+
+	return tombs->nitems && rhashmap_lookup(tombs, key, len,
+	    compute_hash(tombs, key, len)) != RH_NOTFOUND;
+}
+
+/*
+ * rhashmap_find: find the bucket of the given key, also looking into
+ * the old table if the incremental resize is in progress.
+ *
+ * => The arrays are allocated on the first insert (see rhashmap_insert()).
+ * => If key is present, return the bucket index and set the table it
+ *    belongs to; otherwise return RH_NOTFOUND.
+ * => Set the hash of the key (for the current table).
+ */
+static size_t
+rhashmap_find(rhashmap_t *hmap, const void *key, size_t len,
+    uint64_t *hashp, rhashmap_t **tblp)
+{
+	rhashmap_t *old = hmap->old;
+	uint64_t hash;
+	size_t i;
+
+	*tblp = hmap;
+	if (__predict_false(hmap->meta == NULL)) {
+		/* Not allocated yet: empty (and not even seeded). */
+		*hashp = 0;
+		return RH_NOTFOUND;
+	}
+	*hashp = hash = compute_hash(hmap, key, len);
+
+	i = rhashmap_lookup(hmap, key, len, hash);
+	if (__predict_true(i != RH_NOTFOUND || old == NULL)) {
+		return i;
+	}
+	if (__predict_false(hmap->bg != NULL) && tomb_p(hmap, key, len)) {
+		/* Deleted during the background resize. */
+		return RH_NOTFOUND;
+	}
+	*tblp = old;
+	return rhashmap_lookup(old, key, len, (old->hashkey == hmap->hashkey) ?
+	    hash : compute_hash(old, key, len));
+}
+
+/*
+ * rhashmap_get: lookup an value given the key.
+ *
+ * => If key is present, return its associated value; otherwise NULL.
+ */
+void *
+rhashmap_get(rhashmap_t *hmap, const void *key, size_t len)
+{
+	rhashmap_t *tbl;
+	uint64_t hash;
+	size_t i;
+
+	rhashmap_step(hmap);
+	i = rhashmap_find(hmap, key, len, &hash, &tbl);
+	return (i != RH_NOTFOUND) ? bucket_ptr(tbl, i) : NULL;
+}
+
+/*
+ * bucket_shift: move the run of entries in [i, e), in all of the arrays,
+ * by one bucket forwards, incrementing their PSLs.
+ *
+ * => The bucket e must be empty.  Returns the greatest new PSL.
+ */
+static inline unsigned
+bucket_shift(rhashmap_t *hmap, size_t i, size_t e)
+{
+	const size_t n = e - i;
+	unsigned maxpsl = 0;
+
+	ASSERT(meta_empty_p(hmap, e));
+
+	memmove(bucket_meta(hmap, i + 1), bucket_meta(hmap, i),
+	    n * hmap->metasize);
+	memmove(bucket_key(hmap, i + 1), bucket_key(hmap, i),
+	    n * hmap->keysize);
+	if (hmap->valsize) {
+		memmove(bucket_val(hmap, i + 1), bucket_val(hmap, i),
+		    n * hmap->valsize);
+	}
+	memmove(&hmap->ctrl[i + 1], &hmap->ctrl[i], n);
+
+	for (size_t j = i + 1; j <= e; j++) {
+		const unsigned jpsl = meta_psl(hmap, j) + 1;
+
+		meta_set_psl(hmap, j, jpsl);
+		maxpsl = MAX(maxpsl, jpsl);
+	}
+	return maxpsl;
+}
+
+/*
+ * bucket_set: set the entry, i.e. the metadata, key and value, of the
+ * given bucket.
+ *
+ * => The value is copied; if it is NULL, then the value is zeroed.
+ */
+static inline void
+bucket_set(rhashmap_t *hmap, size_t i, uint64_t hash, unsigned psl,
+    size_t len, const rh_key_t *rk, const void *val)
+{
+	meta_set(hmap, i, hash, psl, len);
+	memcpy(bucket_key(hmap, i), rk, hmap->keysize);
+	if (hmap->valsize && val) {
+		memcpy(bucket_val(hmap, i), val, hmap->valsize);
+	} else if (hmap->valsize) {
+		memset(bucket_val(hmap, i), 0, hmap->valsize);
+	}
+	hmap->ctrl[i] = ctrl_byte(hmap, hash);
+}
+
+/*
+ * rhashmap_place: place the entry, i.e. the metadata, key and value,
+ * into the table.
+ *
+ * => The value is copied; if it is NULL, then the value is zeroed.
+ * => Returns the bucket index or RH_NOTFOUND if the PSL bound would be
+ *    exceeded, in which case the table is not modified.
+ */
+static size_t
+rhashmap_place(rhashmap_t *hmap, uint64_t hash, size_t len,
+    const rh_key_t *rk, const void *val)
+{
+	unsigned psl = 0;
+	size_t i, e;
+
+	/*
+	 * From the paper: "when inserting, if a record probes a location
+	 * that is already occupied, the record that has traveled longer
+	 * in its probe sequence keeps the location, and the other one
+	 * continues on its probe sequence" (page 12).
+	 *
+	 * Basically: if the probe sequence length (PSL) of the element
+	 * being inserted is greater than PSL of the element in the bucket,
+	 * then swap them and continue.  Since the elements in a run are
+	 * ordered by their base location, the net effect of the swapping
+	 * is that the element takes the first "rich" bucket and the rest
+	 * of the run (up to the first empty bucket) moves by one.  Hence,
+	 * find the both positions and move the run using memmove().
+	 */
+	i = home_slot(hmap, hash);
+	while (!meta_empty_p(hmap, i) && meta_psl(hmap, i) >= psl) {
+		ASSERT(validate_psl_p(hmap, i));
+		i++, psl++;
+	}
+	if (__predict_false(psl >= hmap->tail)) {
+		return RH_NOTFOUND;
+	}
+	for (e = i; !meta_empty_p(hmap, e); e++) {
+		ASSERT(validate_psl_p(hmap, e));
+		if (__predict_false(meta_psl(hmap, e) + 1U >= hmap->tail)) {
+			return RH_NOTFOUND;
 		}
 	}
-	if (hmap->buckets != &hmap->init_bucket) {
-		free(hmap->buckets);
+	ASSERT(e < hmap->size + hmap->tail);
+
+	/*
+	 * Shift the run, in all of the arrays, and insert the entry.
+	 */
+	if (e > i) {
+		const unsigned maxpsl = bucket_shift(hmap, i, e);
+
+		hmap->maxpsl = MAX(hmap->maxpsl, maxpsl);
 	}
-	free(hmap);
+	bucket_set(hmap, i, hash, psl, len, rk, val);
+	hmap->maxpsl = MAX(hmap->maxpsl, psl);
+	hmap->nitems++;
+
+	ASSERT(validate_psl_p(hmap, i));
+	return i;
+}
+
+/*
+ * mmap_huge: allocate the memory backed by the huge pages, if possible.
+ *
+ * => The length must be a multiple of HUGE_PAGE_SIZE.
+ */
+static void *
+mmap_huge(size_t len)
+{
+	const int prot = PROT_READ | PROT_WRITE;
+	const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	uint8_t *ptr, *aligned;
+
+#ifdef MAP_HUGETLB
+	/*
+	 * Explicit huge pages: succeeds only if there are reserved pages.
+	 */
+	ptr = mmap(NULL, len, prot, flags | MAP_HUGETLB, -1, 0);
+	if (ptr != MAP_FAILED) {
+		return ptr;
+	}
+#endif
+	/*
+	 * Fallback: map with the extra space to align the block to the
+	 * huge page boundary, trim the excess and ask for the transparent
+	 * huge pages (where supported).
+	 */
+	ptr = mmap(NULL, len + HUGE_PAGE_SIZE, prot, flags, -1, 0);
+	if (ptr == MAP_FAILED) {
+		return NULL;
+	}
+	aligned = (uint8_t *)roundup2((uintptr_t)ptr, HUGE_PAGE_SIZE);
+	if (aligned != ptr) {
+		munmap(ptr, (size_t)(aligned - ptr));
+	}
+	munmap(aligned + len, HUGE_PAGE_SIZE - (size_t)(aligned - ptr));
+#ifdef MADV_HUGEPAGE
+	(void)madvise(aligned, len, MADV_HUGEPAGE);
+#endif
+	return aligned;
+}
+
+/*
+ * mem_interleave: set the memory policy of the range to interleave its
+ * pages across all memory nodes allowed for the process.
+ *
+ * => This is only a hint: nothing is done on a single node machine, if
+ *    the system does not support NUMA or the call is not permitted.
+ * => The pages which are already faulted in are not migrated.
+ */
+static void
+mem_interleave(void *ptr, size_t len)
+{
+#if defined(__linux__) && defined(SYS_mbind) && defined(SYS_get_mempolicy)
+	const int mpol_interleave = 3;			/* MPOL_INTERLEAVE */
+	const unsigned long mpol_f_mems_allowed = 1UL << 2;
+	const unsigned nbits = CHAR_BIT * sizeof(unsigned long);
+	unsigned long mask[NUMA_MAX_NODES / (CHAR_BIT * sizeof(unsigned long))];
+	unsigned nnodes = 0;
+
+	memset(mask, 0, sizeof(mask));
+	if (syscall(SYS_get_mempolicy, NULL, mask,
+	    (unsigned long)NUMA_MAX_NODES, NULL, mpol_f_mems_allowed) == -1) {
+		return;
+	}
+	for (unsigned i = 0; i < NUMA_MAX_NODES / nbits; i++) {
+		nnodes += (unsigned)__builtin_popcountl(mask[i]);
+	}
+	if (nnodes < 2) {
+		return;
+	}
+	/* Note: the kernel takes one less than the given number of bits. */
+	(void)syscall(SYS_mbind, ptr, len, mpol_interleave, mask,
+	    (unsigned long)NUMA_MAX_NODES + 1, 0U);
+#else
+	(void)ptr; (void)len;
+#endif
+}
+
+/*
+ * The offsets of the arrays in the memory block and its length.
+ */
+typedef struct {
+	size_t		keys;
+	size_t		vals;
+	size_t		ctrl;
+	size_t		len;
+} rh_layout_t;
+
+/*
+ * mem_layout: compute the layout of the arrays for the given number of
+ * buckets (including the tail).  The metadata array is at the start.
+ */
+static void
+mem_layout(const rhashmap_t *hmap, size_t nbuckets, rh_layout_t *layout)
+{
+	const size_t mlen = roundup2(nbuckets * hmap->metasize,
+	    CACHE_LINE_SIZE);
+	const size_t klen = roundup2(nbuckets * hmap->keysize,
+	    CACHE_LINE_SIZE);
+	const size_t vlen = roundup2(nbuckets * hmap->valsize,
+	    CACHE_LINE_SIZE);
+	const size_t clen = roundup2(CTRL_LEN(nbuckets), CACHE_LINE_SIZE);
+
+	layout->keys = mlen;
+	layout->vals = mlen + klen;
+	layout->ctrl = mlen + klen + vlen;
+	layout->len = mlen + klen + vlen + clen;
+}
+
+/*
+ * mem_set_arrays: set the array pointers given the block and the layout.
+ */
+static void
+mem_set_arrays(rhashmap_t *hmap, uint8_t *base, const rh_layout_t *layout)
+{
+	hmap->meta = base;
+	hmap->keys = base + layout->keys;
+	hmap->vals = hmap->valsize ? base + layout->vals : NULL;
+	hmap->ctrl = base + layout->ctrl;
+}
+
+/*
+ * mem_hugepage_p: return true if the memory block of the arrays of the
+ * given length should be backed by the huge pages.
+ */
+static inline bool
+mem_hugepage_p(const rhashmap_t *hmap, size_t len)
+{
+	return (hmap->flags & RHM_HUGEPAGE) != 0 && len >= HUGE_PAGE_SIZE;
+}
+
+/*
+ * mem_numa_p: return true if the pages of the memory block of the arrays
+ * of the given length should be interleaved across the memory nodes.
+ */
+static inline bool
+mem_numa_p(const rhashmap_t *hmap, size_t len)
+{
+	return (hmap->flags & RHM_NUMA) != 0 && len >= NUMA_MIN_LEN;
+}
+
+/*
+ * mem_mmap_p: return true if the memory block of the arrays of the given
+ * length should be mapped directly, rather than allocated.
+ *
+ * => Only with the default allocator: a custom one decides the placement.
+ */
+static inline bool
+mem_mmap_p(const rhashmap_t *hmap, size_t len)
+{
+	return hmap->alloc == &std_allocator &&
+	    (mem_hugepage_p(hmap, len) || mem_numa_p(hmap, len));
+}
+
+/*
+ * mem_map: map the memory block of the arrays directly, backed by the
+ * huge pages and/or interleaved across the memory nodes as configured.
+ *
+ * => The length must be a multiple of HUGE_PAGE_SIZE.
+ */
+static void *
+mem_map(const rhashmap_t *hmap, size_t len)
+{
+	void *mem;
+
+	if (mem_hugepage_p(hmap, len)) {
+		mem = mmap_huge(len);
+	} else {
+		mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		mem = (mem == MAP_FAILED) ? NULL : mem;
+	}
+	if (mem && mem_numa_p(hmap, len)) {
+		/* Before the first touch, so that no page is misplaced. */
+		mem_interleave(mem, len);
+	}
+	return mem;
+}
+
+/*
+ * mem_hugepage_hint: pass the memory block of a custom allocator to its
+ * huge page hint routine, if any.
+ */
+static inline void
+mem_hugepage_hint(const rhashmap_t *hmap, void *mem, size_t len)
+{
+	const rhashmap_allocator_t *alloc = hmap->alloc;
+
+	if (alloc->hugepage && mem_hugepage_p(hmap, len)) {
+		alloc->hugepage(mem, len, alloc->arg);
+	}
+}
+
+/*
+ * rhashmap_mem_alloc: allocate and setup the zeroed arrays for the
+ * given number of buckets (including the tail).
+ *
+ * => With the default allocator, the huge page backed and the interleaved
+ *    arrays are mapped directly; a custom allocator is given the huge
+ *    page hint instead.
+ */
+static int
+rhashmap_mem_alloc(rhashmap_t *hmap, size_t nbuckets)
+{
+	rh_layout_t layout;
+	uint8_t *mem, *base;
+	size_t len;
+
+	mem_layout(hmap, nbuckets, &layout);
+	len = layout.len;
+
+	if (mem_mmap_p(hmap, len)) {
+		len = roundup2(len, HUGE_PAGE_SIZE);
+		if ((mem = mem_map(hmap, len)) == NULL) {
+			return -1;
+		}
+		base = mem;
+		hmap->mmapped = true;
+	} else {
+		/*
+		 * Note: the zeroed allocation rather than aligned_alloc()
+		 * and memset(), as calloc() has the large blocks zero-filled
+		 * lazily by the kernel.
+		 */
+		len += CACHE_LINE_SIZE;
+		if ((mem = rh_zalloc(hmap, len)) == NULL) {
+			return -1;
+		}
+		mem_hugepage_hint(hmap, mem, len);
+		base = (uint8_t *)roundup2((uintptr_t)mem, CACHE_LINE_SIZE);
+		hmap->mmapped = false;
+	}
+	hmap->mem = mem;
+	hmap->memlen = len;
+	mem_set_arrays(hmap, base, &layout);
+	return 0;
+}
+
+/*
+ * rhashmap_mem_extend: extend the memory block of the arrays to the
+ * new layout, preserving the contents (of the old layout length).
+ *
+ * => The arrays are not moved within the block: the caller must do it.
+ * => Returns the (possibly moved) base of the arrays or NULL on failure,
+ *    in which case the block is not changed.
+ */
+static uint8_t *
+rhashmap_mem_extend(rhashmap_t *hmap, const rh_layout_t *olayout,
+    const rh_layout_t *nlayout)
+{
+	uint8_t *mem, *base;
+	size_t len;
+
+	if (hmap->mmapped) {
+#ifdef MREMAP_MAYMOVE
+		len = roundup2(nlayout->len, HUGE_PAGE_SIZE);
+		mem = mremap(hmap->mem, hmap->memlen, len, MREMAP_MAYMOVE);
+		if (mem == MAP_FAILED) {
+			return NULL;
+		}
+#ifdef MADV_HUGEPAGE
+		if (mem_hugepage_p(hmap, len)) {
+			(void)madvise(mem, len, MADV_HUGEPAGE);
+		}
+#endif
+		if (mem_numa_p(hmap, len)) {
+			mem_interleave(mem, len);
+		}
+		base = mem;
+#else
+		return NULL;
+#endif
+	} else {
+		const size_t off = (size_t)((uint8_t *)hmap->meta -
+		    (uint8_t *)hmap->mem);
+
+		/*
+		 * Note: the alignment padding of the reallocated block
+		 * might be different; if so, then move the contents.
+		 */
+		len = nlayout->len + CACHE_LINE_SIZE;
+		if ((mem = rh_realloc(hmap, hmap->mem, hmap->memlen,
+		    len)) == NULL) {
+			return NULL;
+		}
+		mem_hugepage_hint(hmap, mem, len);
+		base = (uint8_t *)roundup2((uintptr_t)mem, CACHE_LINE_SIZE);
+		if (base != mem + off) {
+			memmove(base, mem + off, olayout->len);
+		}
+	}
+	hmap->mem = mem;
+	hmap->memlen = len;
+	return base;
+}
+
+/*
+ * rhashmap_mem_free: free the memory block of the arrays of the table.
+ */
+static void
+rhashmap_mem_free(const rhashmap_t *tbl)
+{
+	if (tbl->mmapped) {
+		munmap(tbl->mem, tbl->memlen);
+	} else {
+		rh_free(tbl, tbl->mem, tbl->memlen);
+	}
+}
+
+/*
+ * max_buckets: return the maximum number of buckets (including the tail)
+ * the hash table can have.
+ */
+static size_t
+max_buckets(const rhashmap_t *hmap)
+{
+	const size_t bucket_size = hmap->metasize + hmap->keysize +
+	    hmap->valsize + 1;
+
+	if ((hmap->flags & RHM_WIDE) == 0) {
+		/* Note: the compact metadata stores the 32-bit hash. */
+		return UINT_MAX;
+	}
+	return SIZE_MAX / bucket_size / 2;
+}
+
+/*
+ * rhashmap_setup: allocate and setup the new empty arrays of the hash
+ * table, with the given size and the tail length.
+ *
+ * => The current arrays are not freed: it is the caller's responsibility.
+ */
+static int
+rhashmap_setup(rhashmap_t *hmap, size_t newsize, unsigned tail)
+{
+	if (rhashmap_mem_alloc(hmap, newsize + tail) == -1) {
+		return -1;
+	}
+	hmap->size = newsize;
+	hmap->tail = tail;
+	hmap->nitems = 0;
+	hmap->ndeleted = 0;
+	hmap->maxpsl = 0;
+
+	if (hmap->flags & RHM_WIDE) {
+		hmap->wdivinfo = fast_div64_init(newsize);
+	} else {
+		hmap->divinfo = fast_div32_init(newsize);
+	}
+	return 0;
+}
+
+/*
+ * Parallel resize (see rhashmap_par_resize()).
+ *
+ * The entries are partitioned by the range of their new home buckets,
+ * one range per thread.  Each thread places its entries only within its
+ * range: an entry which the Robin Hood displacement would push past the
+ * end of the range is set aside (spilled) and placed once all threads
+ * complete.  Such entries belong to the runs crossing the boundaries,
+ * hence there are few of them: less than the PSL bound per range.
+ */
+typedef struct {
+	uint64_t	hash;
+	size_t		len;
+	rh_key_t	key;
+} rh_spill_t;
+
+typedef enum { PAR_COUNT, PAR_SCATTER, PAR_PLACE } rh_parphase_t;
+
+typedef struct rh_parresize rh_parresize_t;
+
+typedef struct {
+	rh_parresize_t *par;
+	unsigned	id;
+	pthread_t	thread;
+	size_t		nitems;
+	unsigned	maxpsl;
+	size_t		nspills;
+	int		error;
+} rh_parworker_t;
+
+struct rh_parresize {
+	const rhashmap_t *old;
+	rhashmap_t *	hmap;
+	rh_parphase_t	phase;
+	unsigned	nworkers;
+
+	/*
+	 * The old bucket indexes grouped by the range, the number of them
+	 * (and then the offsets) per slice of the old table and per range,
+	 * and the spilled entries (with the values) of each range.
+	 */
+	size_t *	index;
+	size_t		start[MAX_RESIZE_THREADS + 1];
+	size_t		counts[MAX_RESIZE_THREADS][MAX_RESIZE_THREADS];
+	uint8_t *	spills;
+	size_t		spillsize;
+	rh_parworker_t	workers[MAX_RESIZE_THREADS];
+};
+
+/*
+ * par_nworkers: return the number of threads to resize the table with
+ * the given number of the old buckets.
+ */
+static inline unsigned
+par_nworkers(const rhashmap_t *hmap, size_t oldlen)
+{
+	return (unsigned)MIN(hmap->nthreads, oldlen / MIN_PAR_RESIZE);
+}
+
+/*
+ * par_range: return the range of the given new home bucket.
+ */
+static inline unsigned
+par_range(const rh_parresize_t *par, size_t home)
+{
+	return (unsigned)((uint64_t)home * par->nworkers / par->hmap->size);
+}
+
+/*
+ * par_range_end: return the first bucket past the range, i.e. the first
+ * home bucket of the next range or, for the last range, the table end.
+ */
+static inline size_t
+par_range_end(const rh_parresize_t *par, unsigned r)
+{
+	const rhashmap_t *hmap = par->hmap;
+
+	if (r == par->nworkers - 1) {
+		return hmap->size + hmap->tail;
+	}
+	return (size_t)(((uint64_t)(r + 1) * hmap->size +
+	    par->nworkers - 1) / par->nworkers);
+}
+
+/*
+ * par_spill: set the entry aside, copying it into the spill records.
+ */
+static int
+par_spill(rh_parworker_t *w, uint64_t hash, size_t len,
+    const rh_key_t *rk, const void *val)
+{
+	rh_parresize_t *par = w->par;
+	const rhashmap_t *hmap = par->hmap;
+	rh_spill_t *sp;
+
+	if (w->nspills == hmap->tail) {
+		/* The PSL bound would be exceeded anyway. */
+		return -1;
+	}
+	sp = (void *)(par->spills +
+	    (w->id * hmap->tail + w->nspills++) * par->spillsize);
+	sp->hash = hash;
+	sp->len = len;
+	memcpy(&sp->key, rk, hmap->keysize);
+	if (hmap->valsize) {
+		memcpy(sp + 1, val, hmap->valsize);
+	}
+	return 0;
+}
+
+/*
+ * par_place: place the entry of the given old bucket into the range of
+ * the worker; rhashmap_place() bounded by the end of the range.
+ */
+static int
+par_place(rh_parworker_t *w, size_t src, size_t end)
+{
+	const rhashmap_t *old = w->par->old;
+	rhashmap_t *hmap = w->par->hmap;
+	const uint64_t hash = meta_hash(old, src);
+	const size_t len = meta_len(old, src);
+	const void *val = old->valsize ? bucket_val(old, src) : NULL;
+	unsigned psl = 0;
+	size_t i, e;
+
+	i = home_slot(hmap, hash);
+	while (i < end && !meta_empty_p(hmap, i) && meta_psl(hmap, i) >= psl) {
+		i++, psl++;
+	}
+	if (psl >= hmap->tail) {
+		return -1;
+	}
+	if (i == end) {
+		/* Falls into the next range. */
+		return par_spill(w, hash, len, bucket_key(old, src), val);
+	}
+	for (e = i; e < end && !meta_empty_p(hmap, e); e++) {
+		if (meta_psl(hmap, e) + 1U >= hmap->tail) {
+			return -1;
+		}
+	}
+	if (e == end) {
+		/*
+		 * The run reaches the end of the range: the shift would push
+		 * its last entry into the next range, so set it aside.
+		 */
+		e--;
+		if (par_spill(w, meta_hash(hmap, e), meta_len(hmap, e),
+		    bucket_key(hmap, e), hmap->valsize ?
+		    bucket_val(hmap, e) : NULL) == -1) {
+			return -1;
+		}
+		meta_set(hmap, e, 0, 0, 0);
+		hmap->ctrl[e] = CTRL_EMPTY;
+		w->nitems--;
+	}
+	if (e > i) {
+		const unsigned maxpsl = bucket_shift(hmap, i, e);
+
+		w->maxpsl = MAX(w->maxpsl, maxpsl);
+	}
+	bucket_set(hmap, i, hash, psl, len, bucket_key(old, src), val);
+	w->maxpsl = MAX(w->maxpsl, psl);
+	w->nitems++;
+	return 0;
+}
+
+/*
+ * par_worker: perform the given phase of the parallel resize.
+ *
+ * => PAR_COUNT and PAR_SCATTER: the worker handles a slice of the old
+ *    table, counting and then indexing its entries by the range.
+ * => PAR_PLACE: the worker places the entries of its range.
+ */
+static void *
+par_worker(void *arg)
+{
+	rh_parworker_t *w = arg;
+	rh_parresize_t *par = w->par;
+	const rhashmap_t *old = par->old;
+	const size_t oldlen = old->size + old->tail;
+	const size_t from = oldlen * w->id / par->nworkers;
+	const size_t to = oldlen * (w->id + 1) / par->nworkers;
+	size_t *counts = par->counts[w->id];
+
+	if (par->phase == PAR_PLACE) {
+		const size_t end = par_range_end(par, w->id);
+
+		for (size_t k = par->start[w->id];
+		    k < par->start[w->id + 1]; k++) {
+			if (par_place(w, par->index[k], end) == -1) {
+				w->error = -1;
+				break;
+			}
+		}
+		return NULL;
+	}
+	for (size_t i = from; i < to; i++) {
+		unsigned r;
+
+		if (meta_empty_p(old, i)) {
+			continue;
+		}
+		r = par_range(par, home_slot(par->hmap, meta_hash(old, i)));
+		if (par->phase == PAR_COUNT) {
+			counts[r]++;
+		} else {
+			par->index[counts[r]++] = i;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * par_run: run the given phase on all workers.
+ *
+ * => The calling thread is the first worker; if a thread cannot be
+ *    created, then the calling thread does its work too.
+ */
+static void
+par_run(rh_parresize_t *par, rh_parphase_t phase)
+{
+	bool started[MAX_RESIZE_THREADS];
+
+	par->phase = phase;
+	for (unsigned t = 1; t < par->nworkers; t++) {
+		rh_parworker_t *w = &par->workers[t];
+
+		started[t] = pthread_create(&w->thread, NULL,
+		    par_worker, w) == 0;
+	}
+	par_worker(&par->workers[0]);
+	for (unsigned t = 1; t < par->nworkers; t++) {
+		rh_parworker_t *w = &par->workers[t];
+
+		if (started[t]) {
+			pthread_join(w->thread, NULL);
+		} else {
+			par_worker(w);
+		}
+	}
+}
+
+/*
+ * rhashmap_par_resize: place the entries of the old table into the new
+ * (empty) arrays using multiple threads.
+ *
+ * => Returns 0 on success, -1 if the PSL bound would be exceeded or 1 if
+ *    the parallel resize is not applicable (or cannot be set up), in
+ *    which case the new arrays are not modified.
+ */
+static int
+rhashmap_par_resize(rhashmap_t *hmap, const rhashmap_t *old)
+{
+	const unsigned nworkers = par_nworkers(hmap, old->size + old->tail);
+	const size_t indexlen = MAX(old->nitems, 1) * sizeof(size_t);
+	size_t spillslen, off = 0;
+	rh_parresize_t *par;
+	int error = 0;
+
+	if (nworkers < 2) {
+		return 1;
+	}
+	if ((par = rh_zalloc(hmap, sizeof(rh_parresize_t))) == NULL) {
+		return 1;
+	}
+	par->old = old;
+	par->hmap = hmap;
+	par->nworkers = nworkers;
+	par->spillsize = roundup2(sizeof(rh_spill_t) + hmap->valsize,
+	    _Alignof(rh_spill_t));
+	spillslen = nworkers * hmap->tail * par->spillsize;
+	par->index = rh_alloc(hmap, indexlen);
+	par->spills = rh_alloc(hmap, spillslen);
+	if (par->index == NULL || par->spills == NULL) {
+		error = 1;
+		goto out;
+	}
+	for (unsigned t = 0; t < nworkers; t++) {
+		par->workers[t].par = par;
+		par->workers[t].id = t;
+	}
+
+	/*
+	 * Count the entries of each range in each slice and turn the counts
+	 * into the offsets in the index: grouped by the range and, within
+	 * the range, ordered by the slice, i.e. by the old bucket.
+	 */
+	par_run(par, PAR_COUNT);
+	for (unsigned r = 0; r < nworkers; r++) {
+		par->start[r] = off;
+		for (unsigned t = 0; t < nworkers; t++) {
+			const size_t n = par->counts[t][r];
+
+			par->counts[t][r] = off;
+			off += n;
+		}
+	}
+	par->start[nworkers] = off;
+	ASSERT(off == old->nitems);
+
+	/*
+	 * Index the entries and place each range.  Then, place the spilled
+	 * entries: the runs cross into the next range as usual.
+	 */
+	par_run(par, PAR_SCATTER);
+	par_run(par, PAR_PLACE);
+
+	for (unsigned t = 0; t < nworkers; t++) {
+		const rh_parworker_t *w = &par->workers[t];
+
+		error |= w->error;
+		hmap->nitems += w->nitems;
+		hmap->maxpsl = MAX(hmap->maxpsl, w->maxpsl);
+	}
+	for (unsigned t = 0; error == 0 && t < nworkers; t++) {
+		const rh_parworker_t *w = &par->workers[t];
+
+		for (size_t k = 0; k < w->nspills; k++) {
+			const rh_spill_t *sp = (const void *)(par->spills +
+			    (t * hmap->tail + k) * par->spillsize);
+
+			if (rhashmap_place(hmap, sp->hash, sp->len, &sp->key,
+			    hmap->valsize ? sp + 1 : NULL) == RH_NOTFOUND) {
+				error = -1;
+				break;
+			}
+		}
+	}
+	ASSERT(error != 0 || hmap->nitems == old->nitems);
+out:
+	rh_free(hmap, par->spills, spillslen);
+	rh_free(hmap, par->index, indexlen);
+	rh_free(hmap, par, sizeof(rh_parresize_t));
+	return error;
+}
+
+/*
+ * rhashmap_resize: rebuild the hash table with the given size.
+ *
+ * => The entries are moved to the new arrays: the keys are not copied.
+ * => The stored hashes are reused, unless a new hash key/seed is asked
+ *    for (or turns out to be needed), in which case the keys are rehashed.
+ */
+static int
+rhashmap_resize(rhashmap_t *hmap, size_t newsize, bool reseed)
+{
+	const rhashmap_t old = *hmap;
+	const size_t oldlen = old.meta ? old.size + old.tail : 0;
+	unsigned tail = TAIL_LEN(newsize);
+	int error;
+
+	ASSERT(newsize > 0);
+	ASSERT(newsize > hmap->nitems);
+again:
+	/*
+	 * Check for an overflow and allocate buckets.  Also, generate
+	 * a new hash key/seed, if needed.
+	 */
+	if (newsize > max_buckets(hmap) - tail - CTRL_GROUP_SIZE) {
+		return -1;
+	}
+	if (rhashmap_setup(hmap, newsize, tail) == -1) {
+		*hmap = old;
+		return -1;
+	}
+	if (reseed) {
+		hmap->hashkey ^= random() | (random() << 32);
+	}
+
+	/*
+	 * Place the entries using multiple threads, if set up for it and
+	 * the table is large enough; otherwise (or if that fails to set up),
+	 * place them one by one.
+	 */
+	error = reseed ? 1 : rhashmap_par_resize(hmap, &old);
+	for (size_t i = 0; error == 1 && i < oldlen; i++) {
+		rh_key_t *rk = bucket_key(&old, i);
+		const void *val = old.valsize ? bucket_val(&old, i) : NULL;
+		const size_t len = meta_len(&old, i);
+		uint64_t hash;
+
+		/* Skip the empty buckets. */
+		if (len == 0) {
+			continue;
+		}
+		hash = reseed ? compute_hash(hmap,
+		    key_data(hmap, rk, len), len) : meta_hash(&old, i);
+		if (rhashmap_place(hmap, hash, len, rk, val) == RH_NOTFOUND) {
+			error = -1;
+		}
+	}
+	if (error == -1) {
+		/*
+		 * Unlucky hash seed for this tail length: extend the tail,
+		 * use a new seed and try again.  The old table is intact.
+		 */
+		rhashmap_mem_free(hmap);
+		*hmap = old;
+		tail *= 2;
+		reseed = true;
+		goto again;
+	}
+	if (old.mem) {
+		rhashmap_mem_free(&old);
+	}
+	return 0;
+}
+
+/*
+ * bucket_move: move the entry to the given (empty) bucket.
+ */
+static inline void
+bucket_move(rhashmap_t *hmap, size_t dst, size_t src)
+{
+	ASSERT(meta_empty_p(hmap, dst));
+
+	memcpy(bucket_meta(hmap, dst), bucket_meta(hmap, src), hmap->metasize);
+	memcpy(bucket_key(hmap, dst), bucket_key(hmap, src), hmap->keysize);
+	if (hmap->valsize) {
+		memcpy(bucket_val(hmap, dst), bucket_val(hmap, src),
+		    hmap->valsize);
+	}
+	hmap->ctrl[dst] = hmap->ctrl[src];
+	meta_set(hmap, src, 0, 0, 0);
+	hmap->ctrl[src] = CTRL_EMPTY;
+}
+
+/*
+ * bucket_swap: swap the entries of the given buckets.
+ */
+static void
+bucket_swap(rhashmap_t *hmap, size_t a, size_t b)
+{
+	uint8_t tmp[CACHE_LINE_SIZE], *pa, *pb, c;
+
+	memcpy(tmp, bucket_meta(hmap, a), hmap->metasize);
+	memcpy(bucket_meta(hmap, a), bucket_meta(hmap, b), hmap->metasize);
+	memcpy(bucket_meta(hmap, b), tmp, hmap->metasize);
+
+	memcpy(tmp, bucket_key(hmap, a), hmap->keysize);
+	memcpy(bucket_key(hmap, a), bucket_key(hmap, b), hmap->keysize);
+	memcpy(bucket_key(hmap, b), tmp, hmap->keysize);
+
+	for (size_t off = 0; off < hmap->valsize; off += sizeof(tmp)) {
+		const size_t n = MIN(sizeof(tmp), hmap->valsize - off);
+
+		pa = (uint8_t *)bucket_val(hmap, a) + off;
+		pb = (uint8_t *)bucket_val(hmap, b) + off;
+		memcpy(tmp, pa, n);
+		memcpy(pa, pb, n);
+		memcpy(pb, tmp, n);
+	}
+	c = hmap->ctrl[a];
+	hmap->ctrl[a] = hmap->ctrl[b];
+	hmap->ctrl[b] = c;
+}
+
+/*
+ * rhashmap_grow_inplace: double the power-of-two sized hash table in
+ * place: extend the memory block (using realloc() or mremap()), rather
+ * than allocating a new one, and redistribute the entries.
+ *
+ * => The home bucket is taken from the high bits of the hash, therefore
+ *    doubling the size maps the home bucket h to 2h or 2h + 1.  Hence,
+ *    if the entries of the same home are ordered by the new home, then
+ *    the entries keep their order, none of them moves backwards and the
+ *    PSLs increase by one at most.
+ * => Returns 0 on success or -1 if not possible or on failure, in which
+ *    case the hash table is not changed.
+ */
+static int
+rhashmap_grow_inplace(rhashmap_t *hmap, size_t newsize)
+{
+	const size_t size = hmap->size, oldlen = size + hmap->tail;
+	const unsigned tail = MAX(TAIL_LEN(newsize), hmap->tail);
+	const size_t newlen = newsize + tail;
+	rh_layout_t olayout, nlayout;
+	size_t next = 0;
+	uint8_t *base;
+
+	if ((hmap->flags & RHM_POW2) == 0 || newsize != size << 1 ||
+	    hmap->maxpsl + 1 >= tail) {
+		return -1;
+	}
+	if (newsize > max_buckets(hmap) - tail - CTRL_GROUP_SIZE) {
+		return -1;
+	}
+	mem_layout(hmap, oldlen, &olayout);
+	mem_layout(hmap, newlen, &nlayout);
+	if (!hmap->mmapped && mem_mmap_p(hmap, nlayout.len)) {
+		/* Switch to the mapped block: allocate a new one. */
+		return -1;
+	}
+	if ((base = rhashmap_mem_extend(hmap, &olayout, &nlayout)) == NULL) {
+		return -1;
+	}
+
+	/*
+	 * Move the arrays to their new offsets, the last one first, and
+	 * zero the extended parts of the metadata and control bytes (the
+	 * keys and values of the empty buckets are never accessed).
+	 */
+	memmove(base + nlayout.ctrl, base + olayout.ctrl, CTRL_LEN(oldlen));
+	if (hmap->valsize) {
+		memmove(base + nlayout.vals, base + olayout.vals,
+		    oldlen * hmap->valsize);
+	}
+	memmove(base + nlayout.keys, base + olayout.keys,
+	    oldlen * hmap->keysize);
+	mem_set_arrays(hmap, base, &nlayout);
+	memset(bucket_meta(hmap, oldlen), 0,
+	    (newlen - oldlen) * hmap->metasize);
+	memset(&hmap->ctrl[CTRL_LEN(oldlen)], 0, newlen - oldlen);
+
+	hmap->size = newsize;
+	hmap->tail = tail;
+	hmap->maxpsl = 0;
+	hmap->ndeleted = 0;
+	if (hmap->flags & RHM_WIDE) {
+		hmap->wdivinfo = fast_div64_init(newsize);
+	} else {
+		hmap->divinfo = fast_div32_init(newsize);
+	}
+
+	/*
+	 * First, order the entries of the same home (a run, as the homes
+	 * are sorted) by their new home: 2h first, then 2h + 1.
+	 */
+	for (size_t i = 0, e; i < oldlen; i = e) {
+		size_t h, l, r;
+
+		if (meta_empty_p(hmap, i)) {
+			e = i + 1;
+			continue;
+		}
+		h = home_slot(hmap, meta_hash(hmap, i)) >> 1;
+		for (e = i + 1; e < oldlen && !meta_empty_p(hmap, e) &&
+		    (home_slot(hmap, meta_hash(hmap, e)) >> 1) == h; e++)
+			continue;
+
+		for (l = i, r = e;;) {
+			while (l < r &&
+			    (home_slot(hmap, meta_hash(hmap, l)) & 1) == 0)
+				l++;
+			while (l < r &&
+			    (home_slot(hmap, meta_hash(hmap, r - 1)) & 1) != 0)
+				r--;
+			if (l == r) {
+				break;
+			}
+			bucket_swap(hmap, l++, --r);
+		}
+	}
+
+	/*
+	 * Second, spread the entries, moving each from the bucket i to 2i
+	 * (or i + size in the old tail), going backwards.  Finally, going
+	 * forwards, move each entry to its final bucket: its new home or
+	 * the bucket after the previous entry, whichever is further.  It
+	 * is at most one bucket after the spread position, which is free.
+	 */
+	for (size_t i = oldlen; i-- > 1;) {
+		const size_t j = (i < size) ? 2 * i : i + size;
+
+		if (!meta_empty_p(hmap, i)) {
+			bucket_move(hmap, j, i);
+		}
+	}
+	for (size_t i = 0; i < newlen; i++) {
+		size_t home, j;
+		unsigned psl;
+
+		if (meta_empty_p(hmap, i)) {
+			continue;
+		}
+		home = home_slot(hmap, meta_hash(hmap, i));
+		j = MAX(home, next);
+		ASSERT(j <= i + 1);
+
+		if (j != i) {
+			bucket_move(hmap, j, i);
+		}
+		psl = (unsigned)(j - home);
+		ASSERT(psl < tail);
+		meta_set_psl(hmap, j, psl);
+		hmap->maxpsl = MAX(hmap->maxpsl, psl);
+		ASSERT(validate_psl_p(hmap, j));
+
+		next = j + 1;
+		i = MAX(i, j);
+	}
+	return 0;
+}
+
+/*
+ * grow_size: return the new size to grow the hash table to.
+ */
+static size_t
+grow_size(const rhashmap_t *hmap)
+{
+	const size_t size = hmap->size, pct = hmap->growth - 100;
+	size_t step;
+
+	/*
+	 * Grow the hash table by the growth factor (note: avoiding the
+	 * overflow), but with a limit of the growth step, if any, unless
+	 * the size must be kept as a power of two: then round it up.
+	 */
+	step = MAX(size / 100 * pct + size % 100 * pct / 100, 1);
+	if (hmap->flags & RHM_POW2) {
+		return (size_t)1 << fls64(size + step - 1);
+	}
+	if (hmap->growstep) {
+		step = MIN(step, hmap->growstep);
+	}
+	return size + step;
+}
+
+/*
+ * fit_size: return the smallest size of the hash table which holds the
+ * given number of items without exceeding the growth threshold, but not
+ * less than the minimum size; zero if there is no such size.
+ */
+static size_t
+fit_size(const rhashmap_t *hmap, size_t nitems)
+{
+	const size_t maxsize = max_buckets(hmap);
+	const size_t q = nitems / hmap->maxload, r = nitems % hmap->maxload;
+	size_t size;
+
+	/*
+	 * Note: divide first, so that the scaling cannot overflow with
+	 * the large numbers of items (of the RHM_WIDE maps).
+	 */
+	if (q > (maxsize >> 10)) {
+		return 0;
+	}
+	size = MAX((q << 10) + (r << 10) / hmap->maxload + 1, hmap->minsize);
+	if (size > maxsize) {
+		return 0;
+	}
+	if (hmap->flags & RHM_POW2) {
+		size = (size_t)1 << fls64(size - 1);
+	}
+	return size;
+}
+
+/*
+ * total_items: return the number of items, including the items in the
+ * old table, if the incremental resize is in progress.
+ */
+static inline size_t
+total_items(const rhashmap_t *hmap)
+{
+	return hmap->nitems + (hmap->old ? hmap->old->nitems : 0);
+}
+
+/*
+ * rhashmap_migrate: migrate up to the given number of buckets from the
+ * old table to the current one and complete the incremental resize once
+ * all of them are migrated.
+ *
+ * => The entries are moved, reusing the stored hashes (unless the hash
+ *    key/seed of the current table has changed since).
+ * => Returns 0 on success or -1 if the current table needed to grow and
+ *    it could not; the old table is then still consistent.
+ */
+static int
+rhashmap_migrate(rhashmap_t *hmap, size_t nbuckets)
+{
+	rhashmap_t *old = hmap->old;
+	const size_t end = old->size + old->tail;
+	const size_t stop = MIN(end, old->migrated + MIN(nbuckets, end));
+
+	while (old->migrated < stop) {
+		const size_t i = old->migrated;
+		const size_t len = meta_len(old, i);
+		rh_key_t *rk = bucket_key(old, i);
+		const void *val = old->valsize ? bucket_val(old, i) : NULL;
+		uint64_t hash;
+
+		if (len == 0) {
+			old->migrated++;
+			continue;
+		}
+		hash = (old->hashkey == hmap->hashkey) ? meta_hash(old, i) :
+		    compute_hash(hmap, key_data(old, rk, len), len);
+		if (rhashmap_place(hmap, hash, len, rk, val) == RH_NOTFOUND) {
+			/*
+			 * The PSL bound would be exceeded: grow the current
+			 * table (synchronously), at least to fit all of the
+			 * items, and retry.
+			 */
+			const size_t newsize = MAX(grow_size(hmap),
+			    fit_size(hmap, total_items(hmap)));
+
+			if (rhashmap_resize(hmap, newsize, false)) {
+				return -1;
+			}
+			continue;
+		}
+		old->nitems--;
+		old->migrated++;
+	}
+	if (old->migrated == end) {
+		/*
+		 * All migrated: the keys are now owned by the current table.
+		 */
+		ASSERT(old->nitems == 0);
+		rhashmap_mem_free(old);
+		rh_free(hmap, old, sizeof(rhashmap_t));
+		hmap->old = NULL;
+	}
+	return 0;
+}
+
+/*
+ * rhashmap_step: make a step of the incremental resize or complete the
+ * background resize, if the new table is ready.
+ */
+static inline void
+rhashmap_step(rhashmap_t *hmap)
+{
+	if (__predict_true(hmap->old == NULL)) {
+		return;
+	}
+	if (hmap->bg == NULL) {
+		(void)rhashmap_migrate(hmap, hmap->resize_step);
+	} else if (atomic_load_explicit(&hmap->bg->done,
+	    memory_order_acquire)) {
+		rhashmap_bg_replay(hmap, hmap->bg->step);
+	}
+}
+
+/*
+ * rhashmap_resize_start: start the incremental resize to the given size.
+ *
+ * => The current arrays become the old table and the new (empty) arrays
+ *    become current.  The entries are migrated by rhashmap_step().
+ */
+static int
+rhashmap_resize_start(rhashmap_t *hmap, size_t newsize)
+{
+	const size_t nitems = hmap->nitems;
+	size_t headroom, nbuckets;
+	rhashmap_t *old;
+
+	ASSERT(hmap->old == NULL);
+	ASSERT(newsize > nitems);
+
+	if (newsize > max_buckets(hmap) - TAIL_LEN(newsize) - CTRL_GROUP_SIZE) {
+		return -1;
+	}
+	if ((old = rh_alloc(hmap, sizeof(rhashmap_t))) == NULL) {
+		return -1;
+	}
+	*old = *hmap;
+	if (rhashmap_setup(hmap, newsize, TAIL_LEN(newsize)) == -1) {
+		rh_free(hmap, old, sizeof(rhashmap_t));
+		return -1;
+	}
+	old->migrated = 0;
+	hmap->old = old;
+
+	/*
+	 * Spread the migration over the operations: complete it in about
+	 * half of the inserts which the new table can take before it has
+	 * to grow again.
+	 */
+	nbuckets = old->size + old->tail;
+	headroom = LOAD_LIMIT(newsize, hmap->maxload) > nitems ?
+	    (LOAD_LIMIT(newsize, hmap->maxload) - nitems) / 2 : 0;
+	hmap->resize_step = MAX(MIN_RESIZE_STEP,
+	    nbuckets / MAX(headroom, 1) + 1);
+	return 0;
+}
+
+/*
+ * rhashmap_bg_build: the helper thread of the background resize.
+ */
+static void *
+rhashmap_bg_build(void *arg)
+{
+	rh_bgresize_t *bg = arg;
+
+	/*
+	 * Note: the resize does not free the arrays of the old table,
+	 * as their memory block is not referenced by the copy.
+	 */
+	bg->error = rhashmap_resize(&bg->table, bg->newsize, false);
+	atomic_store_explicit(&bg->done, true, memory_order_release);
+	return NULL;
+}
+
+/*
+ * rhashmap_bg_start: start the background resize to the given size.
+ *
+ * => The current arrays become the old table, frozen until the resize
+ *    completes, and the new (empty) arrays of the log become current.
+ * => The log is a fraction of the table: it only needs to absorb the
+ *    inserts made while the new table is built (it grows, if needed).
+ */
+static int
+rhashmap_bg_start(rhashmap_t *hmap, size_t newsize)
+{
+	const size_t logsize = MAX(hmap->size >> 4, 1);
+	const rhashmap_params_t tparams = {
+		/*
+		 * Note: the tombstones have their own key copies, as the
+		 * entries of the old table move during the replay.
+		 */
+		.flags = RHM_NOVAL |
+		    (hmap->flags & (RHM_U64KEY | RHM_NONCRYPTO | RHM_WIDE)),
+		.allocator = hmap->alloc,
+	};
+	rh_bgresize_t *bg;
+	rhashmap_t *old;
+
+	ASSERT(hmap->old == NULL);
+
+	if ((bg = rh_zalloc(hmap, sizeof(rh_bgresize_t))) == NULL) {
+		return -1;
+	}
+	if ((bg->tombs = rhashmap_create_ex(&tparams)) == NULL) {
+		rh_free(hmap, bg, sizeof(rh_bgresize_t));
+		return -1;
+	}
+	if ((old = rh_alloc(hmap, sizeof(rhashmap_t))) == NULL) {
+		goto err;
+	}
+	*old = *hmap;
+	old->migrated = 0;
+
+	bg->newsize = newsize;
+	bg->table = *hmap;
+	bg->table.mem = NULL;
+	atomic_init(&bg->done, false);
+
+	if (rhashmap_setup(hmap, logsize, TAIL_LEN(logsize)) == -1) {
+		rh_free(hmap, old, sizeof(rhashmap_t));
+		goto err;
+	}
+	if (pthread_create(&bg->thread, NULL, rhashmap_bg_build, bg) != 0) {
+		rhashmap_mem_free(hmap);
+		*hmap = *old;
+		rh_free(hmap, old, sizeof(rhashmap_t));
+		goto err;
+	}
+	hmap->old = old;
+	hmap->bg = bg;
+	return 0;
+err:
+	rhashset_destroy(bg->tombs);
+	rh_free(hmap, bg, sizeof(rh_bgresize_t));
+	return -1;
+}
+
+/*
+ * rhashmap_bg_unlink: remove the entry of the old table from both the
+ * old and the new tables, once the new table is built.
+ *
+ * => The key copy is shared by the tables, so it is freed once.
+ * => If the new table could not be built, the old table is switched to.
+ */
+static void
+rhashmap_bg_unlink(rhashmap_t *hmap, size_t i, void *valp)
+{
+	rh_bgresize_t *bg = hmap->bg;
+	rhashmap_t *old = hmap->old;
+
+	ASSERT(bg->joined);
+
+	if (bg->error == 0) {
+		const size_t len = meta_len(old, i);
+		const void *key = key_data(old, bucket_key(old, i), len);
+		size_t j;
+
+		j = rhashmap_lookup(&bg->table, key, len,
+		    compute_hash(&bg->table, key, len));
+		ASSERT(j != RH_NOTFOUND);
+		rhashmap_remove_at(&bg->table, j, NULL);
+	}
+	rhashmap_remove_at(old, i, valp);
+}
+
+/*
+ * rhashmap_bg_replay: replay the deletes into the new table, scanning up
+ * to the given number of the tombstone buckets, and complete the
+ * background resize once all of them are replayed.
+ *
+ * => Called by rhashmap_step() once the helper thread is done, so the
+ *    join does not wait (unlike in rhashmap_bg_finish()).
+ * => The replayed keys are removed from the old table as well, so the
+ *    lookups in it remain consistent.  The deletes of the keys in the
+ *    old table are no longer recorded as the tombstones since, but are
+ *    made in both tables (see rhashmap_remove()).
+ * => The budget is derived from the headroom of the log, as in the
+ *    incremental resize, so the replay completes before it fills up.
+ */
+static void
+rhashmap_bg_replay(rhashmap_t *hmap, size_t budget)
+{
+	rh_bgresize_t *bg = hmap->bg;
+	rhashmap_t *old = hmap->old, *tombs = bg->tombs;
+	const size_t nbuckets = tombs->size + tombs->tail;
+
+	if (!bg->joined) {
+		size_t limit, headroom;
+
+		pthread_join(bg->thread, NULL);
+		bg->joined = true;
+		bg->cursor = tombs->nitems ? 0 : nbuckets;
+
+		/* Note: the arena might have been allocated by an insert. */
+		bg->table.arena = hmap->arena;
+
+		/*
+		 * The key copies are now owned by the new table: the old
+		 * table must not free them (the structure is discarded on
+		 * completion, so the flag need not be restored).
+		 */
+		if (bg->error == 0) {
+			old->flags |= RHM_NOCOPY;
+		}
+
+		limit = LOAD_LIMIT(hmap->size, hmap->maxload);
+		headroom = limit > hmap->nitems ?
+		    (limit - hmap->nitems) / 2 : 0;
+		bg->step = MAX(MIN_RESIZE_STEP,
+		    nbuckets / MAX(headroom, 1) + 1);
+	}
+
+	while (budget && bg->cursor < nbuckets) {
+		const size_t c = bg->cursor++;
+		const size_t len = meta_len(tombs, c);
+		const void *key;
+		size_t i;
+
+		budget--;
+		if (len == 0) {
+			continue;
+		}
+		key = key_data(tombs, bucket_key(tombs, c), len);
+		i = rhashmap_lookup(old, key, len, compute_hash(old, key, len));
+		ASSERT(i != RH_NOTFOUND);
+		rhashmap_bg_unlink(hmap, i, NULL);
+	}
+	if (bg->cursor == nbuckets) {
+		rhashmap_bg_switch(hmap);
+	}
+}
+
+/*
+ * rhashmap_bg_finish: complete the background resize synchronously:
+ * wait for the helper thread and replay all of the deletes.
+ */
+static void
+rhashmap_bg_finish(rhashmap_t *hmap)
+{
+	rhashmap_bg_replay(hmap, SIZE_MAX);
+}
+
+/*
+ * rhashmap_bg_switch: switch to the new table or, if it could not be
+ * built, to the old table, once the deletes are replayed.  The log is
+ * then migrated as in the incremental resize.
+ */
+static void
+rhashmap_bg_switch(rhashmap_t *hmap)
+{
+	rh_bgresize_t *bg = hmap->bg;
+	rhashmap_t *old = hmap->old, tbl;
+	size_t nbuckets, headroom, limit;
+
+	tbl = bg->error ? *old : bg->table;
+	tbl.old = NULL;
+	tbl.bg = NULL;
+	tbl.arena = hmap->arena;
+
+	rhashset_destroy(bg->tombs);
+	if (bg->error == 0) {
+		rhashmap_mem_free(old);
+	}
+	rh_free(hmap, bg, sizeof(rh_bgresize_t));
+
+	/*
+	 * Replay the inserts: the log becomes the old table of an incremental
+	 * resize (reusing the structure of the frozen table), so its entries
+	 * are migrated by rhashmap_step() as usual.
+	 */
+	*old = *hmap;
+	old->old = NULL;
+	old->bg = NULL;
+	old->migrated = 0;
+
+	*hmap = tbl;
+	hmap->old = old;
+	nbuckets = old->size + old->tail;
+	limit = LOAD_LIMIT(hmap->size, hmap->maxload);
+	headroom = limit > total_items(hmap) ?
+	    (limit - total_items(hmap)) / 2 : 0;
+	hmap->resize_step = MAX(MIN_RESIZE_STEP,
+	    nbuckets / MAX(headroom, 1) + 1);
+}
+
+/*
+ * rhashmap_finish: complete the resize in progress, if any.
+ */
+static int
+rhashmap_finish(rhashmap_t *hmap)
+{
+	if (hmap->bg) {
+		rhashmap_bg_finish(hmap);
+	}
+	if (hmap->old) {
+		return rhashmap_migrate(hmap, SIZE_MAX);
+	}
+	return 0;
+}
+
+/*
+ * rhashmap_rebuild: grow or shrink the hash table as a part of the load
+ * factor based resizing.
+ *
+ * => In the RHM_INCREMENTAL mode, start the incremental resize, first
+ *    completing the one in progress (if any); otherwise, resize.
+ */
+static int
+rhashmap_rebuild(rhashmap_t *hmap, bool grow)
+{
+	size_t newsize;
+
+	if (hmap->bg) {
+		/* Background resize in progress: just grow the log. */
+		ASSERT(grow);
+		return rhashmap_resize(hmap, grow_size(hmap), false);
+	}
+	if (rhashmap_finish(hmap) == -1) {
+		return -1;
+	}
+	if (grow) {
+		/* Note: the table might have grown during the migration. */
+		if (hmap->nitems <= LOAD_LIMIT(hmap->size, hmap->maxload)) {
+			return 0;
+		}
+		newsize = grow_size(hmap);
+	} else {
+		newsize = MAX(hmap->size >> 1, hmap->minsize);
+	}
+	if (hmap->flags & RHM_INCREMENTAL) {
+		return rhashmap_resize_start(hmap, newsize);
+	}
+	if (grow && (hmap->flags & RHM_BACKGROUND) &&
+	    hmap->size >= MIN_BG_RESIZE &&
+	    rhashmap_bg_start(hmap, newsize) == 0) {
+		return 0;
+	}
+	/* Double in place, unless the parallel resize would be used. */
+	if (grow && par_nworkers(hmap, hmap->size + hmap->tail) < 2 &&
+	    rhashmap_grow_inplace(hmap, newsize) == 0) {
+		return 0;
+	}
+	return rhashmap_resize(hmap, newsize, false);
+}
+
+/*
+ * rhashmap_insert: internal rhashmap_put().
+ *
+ * => The value is copied (see rhashmap_place()).
+ * => Returns the bucket index of the new or, if the key is already
+ *    present, the existing entry; RH_NOTFOUND on failure.
+ * => Indicates whether the key was already present via *foundp.
+ */
+static size_t
+rhashmap_insert(rhashmap_t *hmap, const void *key, size_t len,
+    const void *val, bool *foundp, rhashmap_t **tblp)
+{
+	const size_t maxlen = (hmap->flags & RHM_WIDE) ?
+	    UINT32_MAX : UINT16_MAX;
+	bool reseeded = false;
+	uint64_t hash;
+	rh_key_t rk;
+	size_t nitems, i;
+
+	ASSERT(key != NULL);
+	ASSERT(len != 0);
+
+	if (__predict_false(len > maxlen)) {
+		/* The key length does not fit the metadata. */
+		return RH_NOTFOUND;
+	}
+
+	/*
+	 * Allocate the arrays on the first insert, so the hash maps which
+	 * stay empty take no more memory than the structure itself.  Also,
+	 * generate the hash key/seed.
+	 */
+	if (__predict_false(hmap->meta == NULL) &&
+	    rhashmap_resize(hmap, hmap->minsize, true) != 0) {
+		return RH_NOTFOUND;
+	}
+
+	/*
+	 * If the load factor is more than the threshold, then resize.
+	 */
+	rhashmap_step(hmap);
+	nitems = hmap->bg ? hmap->nitems : total_items(hmap);
+	if (__predict_false(nitems > LOAD_LIMIT(hmap->size, hmap->maxload))) {
+		if (rhashmap_rebuild(hmap, true) != 0) {
+			return RH_NOTFOUND;
+		}
+	}
+
+	i = rhashmap_find(hmap, key, len, &hash, tblp);
+	if (i != RH_NOTFOUND) {
+		/* Duplicate key: return the current entry. */
+		*foundp = true;
+		return i;
+	}
+	*foundp = false;
+	*tblp = hmap;
+
+	/*
+	 * Setup the bucket entry and place it.
+	 */
+	if (key_set(hmap, &rk, key, len) == -1) {
+		return RH_NOTFOUND;
+	}
+
+	while ((i = rhashmap_place(hmap, hash, len, &rk, val)) == RH_NOTFOUND) {
+		const uint64_t hashkey = hmap->hashkey;
+		bool flooded;
+		size_t newsize;
+
+		/*
+		 * The PSL bound would be exceeded.  At a low load factor,
+		 * it is very unlikely with a random seed, so it suggests
+		 * hash flooding: rebuild the table with a new hash key/seed
+		 * (once).  Otherwise, just grow the hash table.
+		 */
+		flooded = !reseeded && total_items(hmap) < (hmap->size >> 1);
+		newsize = flooded ? hmap->size : grow_size(hmap);
+		if (rhashmap_resize(hmap, newsize, flooded) != 0) {
+			key_free(hmap, &rk, len);
+			return RH_NOTFOUND;
+		}
+		reseeded |= flooded;
+
+		/* The hash key/seed might have changed. */
+		if (hmap->hashkey != hashkey) {
+			hash = compute_hash(hmap, key, len);
+		}
+	}
+	return i;
+}
+
+/*
+ * rhashmap_put: insert a value given the key.
+ *
+ * => If the key is already present, return its associated value.
+ * => Otherwise, on successful insert, return the given value.
+ */
+void *
+rhashmap_put(rhashmap_t *hmap, const void *key, size_t len, void *val)
+{
+	rhashmap_t *tbl;
+	bool found;
+	size_t i;
+
+	i = rhashmap_insert(hmap, key, len, &val, &found, &tbl);
+	return (i != RH_NOTFOUND) ? bucket_ptr(tbl, i) : NULL;
+}
+
+/*
+ * rhashmap_intern: return the canonical copy of the key, i.e. the copy
+ * owned by the hash table, inserting the key if it is not present.
+ *
+ * => The map must be created with RHM_INTERN: the key copies are then
+ *    never moved, so the pointer is valid until the key is deleted (or
+ *    the map is cleared or destroyed).
+ * => A new key has the NULL (or zeroed) value.
+ * => Returns NULL on failure or if the map is not in the RHM_INTERN mode
+ *    (the inline keys would move with their buckets).
+ */
+const void *
+rhashmap_intern(rhashmap_t *hmap, const void *key, size_t len)
+{
+	rhashmap_t *tbl;
+	bool found;
+	size_t i;
+
+	if ((hmap->flags & RHM_INTERN) == 0) {
+		return NULL;
+	}
+	i = rhashmap_insert(hmap, key, len, NULL, &found, &tbl);
+	return (i != RH_NOTFOUND) ? key_data(tbl, bucket_key(tbl, i), len) :
+	    NULL;
+}
+
+/*
+ * rhashmap_remove_at: remove the entry in the given bucket.
+ *
+ * => If valp is not NULL, then the value is copied out to it.
+ */
+static void
+rhashmap_remove_at(rhashmap_t *hmap, size_t i, void *valp)
+{
+	const size_t end = hmap->size + hmap->tail;
+	const size_t len = meta_len(hmap, i);
+	size_t e;
+
+	/*
+	 * Free the bucket.
+	 */
+	key_free(hmap, bucket_key(hmap, i), len);
+	if (valp && hmap->valsize) {
+		memcpy(valp, bucket_val(hmap, i), hmap->valsize);
+	}
+	hmap->nitems--;
+
+	/*
+	 * The probe sequence must be preserved in the deletion case.
+	 * Use the backwards-shifting method to maintain low variance:
+	 * find the end of the run, i.e. an empty bucket or a key which
+	 * is in its base (original) location, and move the run back by
+	 * one, in all of the arrays.
+	 */
+	for (e = i + 1; e < end && !meta_empty_p(hmap, e) &&
+	    meta_psl(hmap, e) != 0; e++) {
+		ASSERT(validate_psl_p(hmap, e));
+		meta_set_psl(hmap, e, meta_psl(hmap, e) - 1);
+	}
+	if (e > i + 1) {
+		const size_t n = e - i - 1;
+
+		memmove(bucket_meta(hmap, i), bucket_meta(hmap, i + 1),
+		    n * hmap->metasize);
+		memmove(bucket_key(hmap, i), bucket_key(hmap, i + 1),
+		    n * hmap->keysize);
+		if (hmap->valsize) {
+			memmove(bucket_val(hmap, i), bucket_val(hmap, i + 1),
+			    n * hmap->valsize);
+		}
+		memmove(&hmap->ctrl[i], &hmap->ctrl[i + 1], n);
+	}
+	meta_set(hmap, e - 1, 0, 0, 0);
+	hmap->ctrl[e - 1] = CTRL_EMPTY;
+}
+
+/*
+ * rhashmap_remove: internal rhashmap_del().
+ *
+ * => If valp is not NULL, then the value is copied out to it.
+ * => Returns true if the key was present and false otherwise.
+ */
+static bool
+rhashmap_remove(rhashmap_t *hmap, const void *key, size_t len, void *valp)
+{
+	rhashmap_t *tbl;
+	uint64_t hash;
+	size_t i, nitems;
+
+	rhashmap_step(hmap);
+	i = rhashmap_find(hmap, key, len, &hash, &tbl);
+	if (i == RH_NOTFOUND) {
+		return false;
+	}
+	if (__predict_false(tbl != hmap && hmap->bg != NULL &&
+	    hmap->bg->joined)) {
+		/* The new table is built: remove from both. */
+		rhashmap_bg_unlink(hmap, i, valp);
+		return true;
+	}
+	if (__predict_false(tbl != hmap && hmap->bg != NULL)) {
+		/*
+		 * The old table is frozen: record a tombstone or, if not
+		 * possible, complete the resize and remove the key then.
+		 */
+		const size_t klen = meta_len(tbl, i);
+		const void *kdata = key_data(tbl, bucket_key(tbl, i), klen);
+		rhashmap_t *t;
+		bool found;
+
+		if (rhashmap_insert(hmap->bg->tombs, kdata, klen,
+		    NULL, &found, &t) != RH_NOTFOUND) {
+			if (valp && tbl->valsize) {
+				memcpy(valp, bucket_val(tbl, i), tbl->valsize);
+			}
+			return true;
+		}
+		rhashmap_bg_finish(hmap);
+		return rhashmap_remove(hmap, key, len, valp);
+	}
+	rhashmap_remove_at(tbl, i, valp);
+
+	/*
+	 * If the load factor is less than threshold, then shrink by
+	 * halving the size, but not more than the minimum size.
+	 * Do not start shrinking while a resize is in progress, if
+	 * disabled or until the given number of deletes since the
+	 * last resize (hysteresis).
+	 */
+	nitems = hmap->nitems;
+	hmap->ndeleted++;
+	if (hmap->old == NULL && nitems > hmap->minsize &&
+	    nitems < LOAD_LIMIT(hmap->size, hmap->minload) &&
+	    hmap->ndeleted > hmap->shrinkdelay &&
+	    (hmap->flags & RHM_NOSHRINK) == 0) {
+		(void)rhashmap_rebuild(hmap, false);
+	}
+	return true;
+}
+
+/*
+ * rhashmap_del: remove the given key and return its value.
+ *
+ * => If key was present, return its associated value; otherwise NULL.
+ */
+void *
+rhashmap_del(rhashmap_t *hmap, const void *key, size_t len)
+{
+	void *val = NULL;
+
+	ASSERT((hmap->flags & (RHM_NOVAL | RHM_VALCOPY)) == 0);
+	(void)rhashmap_remove(hmap, key, len, &val);
+	return val;
+}
+
+void *
+rhashmap_walk(rhashmap_t *hmap, uintmax_t *iter, size_t *lenp, void **valp)
+{
+	const size_t hmap_len = hmap->size + hmap->tail;
+	const rhashmap_t *old = hmap->old;
+	const size_t old_len = old ? old->size + old->tail : 0;
+	size_t i = *iter;
+
+	/*
+	 * If the incremental resize is in progress, then walk the current
+	 * table and then the remaining buckets of the old table.
+	 */
+	while (i < hmap_len + old_len) {
+		const rhashmap_t *tbl = (i < hmap_len) ? hmap : old;
+		const size_t b = (i < hmap_len) ? i : i - hmap_len;
+		size_t len;
+
+		i++; // next
+		if (tbl == old && b < old->migrated) {
+			continue;
+		}
+		if ((len = meta_len(tbl, b)) == 0) {
+			continue;
+		}
+		if (tbl == old && hmap->bg && tomb_p(hmap,
+		    key_data(tbl, bucket_key(tbl, b), len), len)) {
+			/* Deleted during the background resize. */
+			continue;
+		}
+		*iter = i;
+		if (lenp) {
+			*lenp = len;
+		}
+		if (valp && (tbl->flags & RHM_VALCOPY)) {
+			*valp = bucket_val(tbl, b);
+		} else if (valp) {
+			*valp = tbl->valsize ? bucket_ptr(tbl, b) : NULL;
+		}
+		return key_data(tbl, bucket_key(tbl, b), len);
+	}
+	return NULL;
+}
+
+/*
+ * rhashmap_compact: shrink the hash table to the smallest size which
+ * holds the current number of items (see fit_size()).
+ *
+ * => Completes the incremental resize, if in progress.
+ * => Returns 0 on success (including when the table is already as
+ *    small) or -1 on failure.
+ */
+int
+rhashmap_compact(rhashmap_t *hmap)
+{
+	size_t newsize;
+
+	if (rhashmap_finish(hmap) == -1) {
+		return -1;
+	}
+	newsize = fit_size(hmap, hmap->nitems);
+	if (newsize >= hmap->size) {
+		return 0;
+	}
+	return rhashmap_resize(hmap, newsize, false);
+}
+
+/*
+ * rhashmap_reserve: grow the hash table, in one resize, to hold the
+ * given number of items without any further resizes.
+ *
+ * => The minimum size is not changed: the table may shrink later.
+ * => Completes the incremental resize, if in progress.
+ * => Returns 0 on success (including when the table is already large
+ *    enough) or -1 on failure.
+ */
+int
+rhashmap_reserve(rhashmap_t *hmap, size_t nitems)
+{
+	size_t newsize;
+
+	if (rhashmap_finish(hmap) == -1) {
+		return -1;
+	}
+	if ((newsize = fit_size(hmap, nitems)) == 0) {
+		return -1;
+	}
+	if (newsize <= hmap->size) {
+		return 0;
+	}
+	/* Note: the first allocation generates the hash key/seed. */
+	return rhashmap_resize(hmap, newsize, hmap->meta == NULL);
+}
+
+/*
+ * key_relocate: move the key copy of the given bucket from the old
+ * chunks of the key compaction to the new ones, if it is there.
+ *
+ * => Returns 0 on success or -1 on failure; the key is then not moved.
+ */
+static int
+key_relocate(rhashmap_t *hmap, const rhashmap_t *tbl, size_t i)
+{
+	rh_arena_t *arena = hmap->arena;
+	const size_t len = meta_len(tbl, i);
+	rh_key_t *rk = bucket_key(tbl, i);
+	void *ptr;
+
+	if (len == 0 || key_inline_p(tbl, len) || len > ARENA_MAX_KEY ||
+	    !arena_old_p(arena, rk->ext.ptr)) {
+		return 0;
+	}
+	if ((ptr = key_alloc(hmap, len)) == NULL) {
+		return -1;
+	}
+	memcpy(ptr, rk->ext.ptr, len);
+	rk->ext.ptr = ptr;
+
+	arena->nkeys--;
+	arena->nbytes -= ARENA_CLASS_SIZE(ARENA_CLASS(len));
+	arena->noldkeys--;
+	return 0;
+}
+
+/*
+ * rhashmap_compact_keys: relocate the key copies into the new chunks of
+ * the key arena, in the bucket order, so that the keys are dense and the
+ * walks through the buckets access them sequentially; then free the old
+ * chunks, reclaiming the space of the deleted keys.
+ *
+ * => Scans up to the given number of buckets (or all, if zero) per call;
+ *    the compaction continues with the next call and the hash table may
+ *    be modified in between.  The entries moved behind the position of
+ *    the scan meanwhile are picked up by another pass.
+ * => Until it completes, the old chunks are kept, i.e. the key space is
+ *    up to twice as large.  The keys above ARENA_MAX_KEY are not moved.
+ * => Does not wait for the background resize in progress.
+ * => The interned keys (RHM_INTERN) are never moved.
+ * => Returns 0 if the compaction completed (or there is nothing to do),
+ *    1 if it is still in progress or -1 on failure.
+ */
+int
+rhashmap_compact_keys(rhashmap_t *hmap, size_t budget)
+{
+	rh_arena_t *arena = hmap->arena;
+	size_t nscanned = 0;
+
+	if (arena == NULL || (hmap->flags & RHM_INTERN) != 0) {
+		/* No key copies (or not yet) or they must not move. */
+		return 0;
+	}
+	if (hmap->bg) {
+		/* The helper thread might be reading the frozen table. */
+		if (!atomic_load_explicit(&hmap->bg->done,
+		    memory_order_acquire)) {
+			return 1;
+		}
+		rhashmap_bg_finish(hmap);
+	}
+	if (arena->oldchunks == NULL) {
+		if (arena->nkeys == 0) {
+			return 0;
+		}
+		if (arena_compact_start(hmap) == -1) {
+			return -1;
+		}
+	}
+
+	/*
+	 * Scan the current table and then the remaining buckets of the old
+	 * table, if the incremental resize is in progress.
+	 */
+	while (arena->noldkeys) {
+		const rhashmap_t *old = hmap->old;
+		const size_t hmap_len = hmap->size + hmap->tail;
+		const size_t old_len = old ? old->size + old->tail : 0;
+		const size_t i = arena->cursor;
+
+		if (budget && nscanned++ == budget) {
+			return 1;
+		}
+		if (i >= hmap_len + old_len) {
+			/* Another pass: some entries moved behind. */
+			arena->cursor = 0;
+			continue;
+		}
+		arena->cursor++;
+		if (i < hmap_len) {
+			if (key_relocate(hmap, hmap, i) == -1) {
+				return -1;
+			}
+		} else if (i - hmap_len >= old->migrated &&
+		    key_relocate(hmap, old, i - hmap_len) == -1) {
+			return -1;
+		}
+	}
+	arena_compact_end(hmap);
+	return 0;
+}
+
+/*
+ * rhashmap_set_policy: validate and set the growth policy parameters,
+ * applying the defaults for the ones not set.
+ *
+ * => The thresholds must not cause the table to shrink right after it
+ *    grew or to grow right after it shrunk (i.e. halved).
+ */
+static int
+rhashmap_set_policy(rhashmap_t *hmap, const rhashmap_params_t *params)
+{
+	const unsigned growth = params->growth ? params->growth : DEF_GROWTH;
+	const unsigned max_load = params->max_load ?
+	    params->max_load : DEF_MAX_LOAD;
+	unsigned min_load = params->min_load;
+
+	if (growth <= 100 || growth > 1000) {
+		return -1;
+	}
+	if (max_load < 10 || max_load > 95) {
+		return -1;
+	}
+	if (min_load == 0) {
+		/* The default, if it fits the other thresholds. */
+		min_load = DEF_MIN_LOAD;
+		if (2 * min_load >= max_load ||
+		    min_load * growth >= max_load * 100) {
+			min_load = max_load * 50 / growth;
+		}
+	}
+	if (2 * min_load >= max_load || min_load * growth >= max_load * 100) {
+		return -1;
+	}
+	hmap->growth = growth;
+	hmap->maxload = LOAD_UNITS(max_load);
+	hmap->minload = LOAD_UNITS(min_load);
+
+	/*
+	 * The growth step is limited by default; the explicitly set growth
+	 * factor without the step means the unlimited geometric growth.
+	 */
+	hmap->growstep = (params->growth || params->growth_step) ?
+	    params->growth_step : MAX_GROWTH_STEP;
+	hmap->shrinkdelay = params->shrink_delay;
+	return 0;
+}
+
+/*
+ * rhashmap_create_ex: construct a new hash table given the parameters.
+ *
+ * => The buckets are allocated on the first insert: if size is non-zero,
+ *    then at least the given number of them; otherwise, a default minimum.
+ * => If valsize is non-zero, then the values of the given size are
+ *    stored by copy (see rhashmap_vput()).
+ * => The growth policy parameters, if set, override the defaults (see
+ *    rhashmap_set_policy()); returns NULL if they are invalid.
+ * => If resize_threads is more than one, then the large tables are
+ *    resized using up to the given number of threads.
+ * => If allocator is set, then all of the memory (including the map
+ *    itself) is allocated using it; alloc, zalloc and free are required.
+ */
+rhashmap_t *
+rhashmap_create_ex(const rhashmap_params_t *params)
+{
+	const rhashmap_allocator_t *alloc = params->allocator ?
+	    params->allocator : &std_allocator;
+	const size_t size = params->size;
+	unsigned flags = params->flags;
+	rhashmap_t *hmap;
+
+	if (!alloc->alloc || !alloc->zalloc || !alloc->free) {
+		return NULL;
+	}
+	hmap = alloc->zalloc(sizeof(rhashmap_t), alloc->arg);
+	if (!hmap) {
+		return NULL;
+	}
+	hmap->alloc = alloc;
+	if ((flags & RHM_BACKGROUND) &&
+	    (params->valsize || (flags & RHM_INCREMENTAL))) {
+		/* The values by copy could be modified in the old table. */
+		rh_free(hmap, hmap, sizeof(rhashmap_t));
+		return NULL;
+	}
+	if ((flags & RHM_INTERN) && (flags & (RHM_U64KEY | RHM_NOCOPY))) {
+		/*
+		 * The integer keys are stored only inline and the keys
+		 * which are not copied have no canonical copy.
+		 */
+		rh_free(hmap, hmap, sizeof(rhashmap_t));
+		return NULL;
+	}
+	if (params->valsize) {
+		ASSERT((flags & RHM_NOVAL) == 0);
+		flags |= RHM_VALCOPY;
+		hmap->valsize = params->valsize;
+	} else {
+		hmap->valsize = (flags & RHM_NOVAL) ? 0 : sizeof(void *);
+	}
+	hmap->flags = flags;
+	if (rhashmap_set_policy(hmap, params) == -1 ||
+	    params->resize_threads > MAX_RESIZE_THREADS) {
+		rh_free(hmap, hmap, sizeof(rhashmap_t));
+		return NULL;
+	}
+	hmap->nthreads = params->resize_threads;
+	hmap->metasize = (flags & RHM_WIDE) ?
+	    sizeof(rh_wmeta_t) : sizeof(rh_meta_t);
+	if (flags & RHM_U64KEY) {
+		hmap->keysize = sizeof(uint64_t);
+		hmap->inlinelen = sizeof(uint64_t);
+	} else if (flags & (RHM_NOCOPY | RHM_INTERN)) {
+		/* The keys are never inline: just the pointer. */
+		hmap->keysize = sizeof(void *);
+		hmap->inlinelen = 0;
+	} else if (flags & RHM_NOVAL) {
+		/* Sets: the key slot only, either the short key or pointer. */
+		hmap->keysize = sizeof(void *);
+		hmap->inlinelen = sizeof(void *);
+	} else {
+		hmap->keysize = sizeof(rh_key_t);
+		hmap->inlinelen = INLINE_KEY_LEN;
+	}
+	hmap->minsize = size ? size : DEF_MIN_SIZE;
+	if (flags & RHM_POW2) {
+		/* Round up to the power of two. */
+		if (hmap->minsize > (max_buckets(hmap) >> 1) + 1) {
+			rh_free(hmap, hmap, sizeof(rhashmap_t));
+			return NULL;
+		}
+		hmap->minsize = (size_t)1 << fls64(hmap->minsize - 1);
+	}
+	if (hmap->minsize > max_buckets(hmap) - TAIL_LEN(hmap->minsize) -
+	    CTRL_GROUP_SIZE) {
+		rh_free(hmap, hmap, sizeof(rhashmap_t));
+		return NULL;
+	}
+	return hmap;
+}
+
+/*
+ * rhashmap_create: construct a new hash table.
+ *
+ * => The buckets are allocated on the first insert: if size is non-zero,
+ *    then at least the given number of them; otherwise, a default minimum.
+ */
+rhashmap_t *
+rhashmap_create(size_t size, unsigned flags)
+{
+	const rhashmap_params_t params = { .size = size, .flags = flags };
+	return rhashmap_create_ex(&params);
+}
+
+/*
+ * rhashmap_release: pass the entries of the table, starting from the
+ * given bucket, to the callback (if any) and free the key copies which
+ * are not in the key arena chunks.
+ *
+ * => The caller frees or resets the key arena afterwards.
+ */
+static void
+rhashmap_release(rhashmap_t *tbl, size_t from, rhashmap_clear_cb_t cb,
+    void *arg)
+{
+	const rh_arena_t *arena = tbl->arena;
+
+	if (cb == NULL && (arena == NULL || arena->nlarge == 0)) {
+		/* Nothing to do: the arena is freed in O(chunks). */
+		return;
+	}
+	for (size_t i = from; i < tbl->size + tbl->tail; i++) {
+		const size_t len = meta_len(tbl, i);
+		rh_key_t *rk = bucket_key(tbl, i);
+
+		if (len == 0) {
+			continue;
+		}
+		if (cb) {
+			void *val = NULL;
+
+			/* The value as returned by rhashmap_walk(). */
+			if (tbl->flags & RHM_VALCOPY) {
+				val = bucket_val(tbl, i);
+			} else if (tbl->valsize) {
+				val = bucket_ptr(tbl, i);
+			}
+			cb(key_data(tbl, rk, len), len, val, arg);
+		}
+		if (arena && len > ARENA_MAX_KEY) {
+			key_dealloc(tbl, rk->ext.ptr, len);
+		}
+	}
+}
+
+/*
+ * mem_zero: zero the memory of the arrays; in the large ranges, release
+ * the whole pages instead, as the anonymous memory is zero-filled on the
+ * next access (on Linux).
+ *
+ * => The memory of a custom allocator might be shared, hence just zeroed.
+ */
+static void
+mem_zero(const rhashmap_t *hmap, void *ptr, size_t len)
+{
+#if defined(__linux__) && defined(MADV_DONTNEED)
+	if (len >= MIN_MADV_ZERO && hmap->alloc == &std_allocator) {
+		const uintptr_t pgmask = (uintptr_t)sysconf(_SC_PAGESIZE) - 1;
+		uint8_t *p = ptr, *start, *end;
+
+		start = (uint8_t *)(((uintptr_t)p + pgmask) & ~pgmask);
+		end = (uint8_t *)(((uintptr_t)p + len) & ~pgmask);
+		if (madvise(start, (size_t)(end - start), MADV_DONTNEED) == 0) {
+			memset(p, 0, (size_t)(start - p));
+			memset(end, 0, (size_t)(p + len - end));
+			return;
+		}
+	}
+#endif
+	memset(ptr, 0, len);
+}
+
+/*
+ * rhashmap_clear: remove all entries, but keep the size of the hash
+ * table (and its memory).
+ *
+ * => The entries are passed to the callback, if any, e.g. to free the
+ *    keys in the RHM_NOCOPY mode or the values.  The key copies are
+ *    freed after the callback returns.
+ * => Completes the background resize and drops the old table of the
+ *    incremental resize, if in progress.
+ */
+void
+rhashmap_clear(rhashmap_t *hmap, rhashmap_clear_cb_t cb, void *arg)
+{
+	rhashmap_t *old;
+
+	if (hmap->bg) {
+		/* Wait for the helper thread and switch to the new table. */
+		rhashmap_bg_finish(hmap);
+	}
+	if ((old = hmap->old) != NULL) {
+		rhashmap_release(old, old->migrated, cb, arg);
+		rhashmap_mem_free(old);
+		rh_free(hmap, old, sizeof(rhashmap_t));
+		hmap->old = NULL;
+	}
+	if (hmap->meta == NULL) {
+		/* Not allocated yet. */
+		return;
+	}
+	rhashmap_release(hmap, 0, cb, arg);
+	if (hmap->arena) {
+		arena_reset(hmap);
+	}
+
+	/* Only the metadata and control bytes tell the empty buckets. */
+	mem_zero(hmap, hmap->meta, (hmap->size + hmap->tail) * hmap->metasize);
+	mem_zero(hmap, hmap->ctrl, hmap->size + hmap->tail);
+	hmap->nitems = 0;
+	hmap->ndeleted = 0;
+	hmap->maxpsl = 0;
+}
+
+/*
+ * rhashmap_destroy: free the memory used by the hash table.
+ *
+ * => It is the responsibility of the caller to remove elements if needed.
+ */
+void
+rhashmap_destroy(rhashmap_t *hmap)
+{
+	rhashmap_t *old;
+
+	if (hmap->bg) {
+		/* Wait for the helper thread and switch to the new table. */
+		rhashmap_bg_finish(hmap);
+	}
+	rhashmap_release(hmap, 0, NULL, NULL);
+	if ((old = hmap->old) != NULL) {
+		/* The old table of the incremental resize in progress. */
+		rhashmap_release(old, old->migrated, NULL, NULL);
+		rhashmap_mem_free(old);
+		rh_free(hmap, old, sizeof(rhashmap_t));
+	}
+	arena_destroy(hmap);
+	rhashmap_mem_free(hmap);
+	rh_free(hmap, hmap, sizeof(rhashmap_t));
+}
+
+/*
+ * The 64-bit integer key interface.
+ *
+ * => The keys are always stored inline, compared as the integers and
+ *    hashed using a fast mixer (note: it is not a cryptographic hash).
+ * => The maps are destroyed and walked using the regular interface.
+ */
+
+rhashmap_t *
+rhashmap_u64_create(size_t size, unsigned flags)
+{
+	/* The keys are copied, as they are stored inline. */
+	return rhashmap_create(size, (flags & ~RHM_NOCOPY) | RHM_U64KEY);
+}
+
+void *
+rhashmap_u64_get(rhashmap_t *hmap, uint64_t key)
+{
+	return rhashmap_get(hmap, &key, sizeof(key));
+}
+
+void *
+rhashmap_u64_put(rhashmap_t *hmap, uint64_t key, void *val)
+{
+	return rhashmap_put(hmap, &key, sizeof(key), val);
+}
+
+void *
+rhashmap_u64_del(rhashmap_t *hmap, uint64_t key)
+{
+	return rhashmap_del(hmap, &key, sizeof(key));
+}
+
+/*
+ * The interface of the values stored by copy.
+ *
+ * => The map must be created using rhashmap_create_ex() with a non-zero
+ *    value size.  The values are kept in a dense array, parallel to the
+ *    keys, and are accessed by the pointers into that array.
+ * => The pointers are valid only until the next put or delete operation,
+ *    as the entries may be moved.
+ */
+
+/*
+ * rhashmap_vget: lookup the value given the key.
+ *
+ * => If key is present, return the pointer to its value; otherwise NULL.
+ */
+void *
+rhashmap_vget(rhashmap_t *hmap, const void *key, size_t len)
+{
+	rhashmap_t *tbl;
+	uint64_t hash;
+	size_t i;
+
+	ASSERT(hmap->flags & RHM_VALCOPY);
+	rhashmap_step(hmap);
+	i = rhashmap_find(hmap, key, len, &hash, &tbl);
+	return (i != RH_NOTFOUND) ? bucket_val(tbl, i) : NULL;
+}
+
+/*
+ * rhashmap_vput: insert the key with a copy of the given value.
+ *
+ * => If val is NULL, then the value is zeroed.
+ * => If the key is already present, then its value is not changed.
+ * => Return the pointer to the value or NULL on failure.
+ */
+void *
+rhashmap_vput(rhashmap_t *hmap, const void *key, size_t len, const void *val)
+{
+	rhashmap_t *tbl;
+	bool found;
+	size_t i;
+
+	ASSERT(hmap->flags & RHM_VALCOPY);
+	i = rhashmap_insert(hmap, key, len, val, &found, &tbl);
+	return (i != RH_NOTFOUND) ? bucket_val(tbl, i) : NULL;
+}
+
+/*
+ * rhashmap_vdel: remove the given key.
+ *
+ * => If valp is not NULL, then the value is copied out to it.
+ * => Return 1 if the key was removed or 0 if it was not present.
+ */
+int
+rhashmap_vdel(rhashmap_t *hmap, const void *key, size_t len, void *valp)
+{
+	ASSERT(hmap->flags & RHM_VALCOPY);
+	return rhashmap_remove(hmap, key, len, valp);
+}
+
+/*
+ * The set interface: a map without the values.
+ *
+ * => The buckets have no value storage, so the sets use less memory
+ *    and the membership checks touch less of it.
+ * => The sets are walked using rhashmap_walk() (the value is NULL).
+ */
+
+rhashset_t *
+rhashset_create(size_t size, unsigned flags)
+{
+	return rhashmap_create(size, flags | RHM_NOVAL);
+}
+
+void
+rhashset_destroy(rhashset_t *hset)
+{
+	rhashmap_destroy(hset);
+}
+
+/*
+ * rhashset_has: return 1 if the key is in the set and 0 otherwise.
+ */
+int
+rhashset_has(rhashset_t *hset, const void *key, size_t len)
+{
+	rhashmap_t *tbl;
+	uint64_t hash;
+
+	rhashmap_step(hset);
+	return rhashmap_find(hset, key, len, &hash, &tbl) != RH_NOTFOUND;
+}
+
+/*
+ * rhashset_add: add the key to the set.
+ *
+ * => Return 1 if the key was added, 0 if already present or -1 on error.
+ */
+int
+rhashset_add(rhashset_t *hset, const void *key, size_t len)
+{
+	rhashmap_t *tbl;
+	bool found;
+
+	if (rhashmap_insert(hset, key, len, NULL, &found, &tbl) ==
+	    RH_NOTFOUND) {
+		return -1;
+	}
+	return !found;
+}
+
+/*
+ * rhashset_del: remove the key from the set.
+ *
+ * => Return 1 if the key was removed or 0 if it was not present.
+ */
+int
+rhashset_del(rhashset_t *hset, const void *key, size_t len)
+{
+	return rhashmap_remove(hset, key, len, NULL);
+}
+
+rhashset_t *
+rhashset_u64_create(size_t size, unsigned flags)
+{
+	return rhashmap_u64_create(size, flags | RHM_NOVAL);
+}
+
+int
+rhashset_u64_has(rhashset_t *hset, uint64_t key)
+{
+	return rhashset_has(hset, &key, sizeof(key));
+}
+
+int
+rhashset_u64_add(rhashset_t *hset, uint64_t key)
+{
+	return rhashset_add(hset, &key, sizeof(key));
+}
+
+int
+rhashset_u64_del(rhashset_t *hset, uint64_t key)
+{
+	return rhashset_del(hset, &key, sizeof(key));
 }
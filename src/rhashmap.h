@@ -15,18 +15,83 @@ typedef struct rhashmap rhashmap_t;
 
 #define	RHM_NOCOPY		0x01
 #define	RHM_NONCRYPTO		0x02
+#define	RHM_POW2		0x04
+#define	RHM_HUGEPAGE		0x08
+#define	RHM_WIDE		0x10
+#define	RHM_INCREMENTAL		0x20
+#define	RHM_NOSHRINK		0x40
+#define	RHM_BACKGROUND		0x80
+#define	RHM_INTERN		0x100
+#define	RHM_NUMA		0x200
+
+/*
+ * The memory allocator: all memory of the hash map is allocated and
+ * freed using these routines (see rhashmap_create_ex()).
+ */
+typedef struct {
+	void *		(*alloc)(size_t, void *);
+	void *		(*zalloc)(size_t, void *);
+	void		(*free)(void *, size_t, void *);
+	void *		(*realloc)(void *, size_t, size_t, void *);
+	void		(*hugepage)(void *, size_t, void *);
+	void *		arg;
+} rhashmap_allocator_t;
+
+typedef struct {
+	size_t		size;
+	unsigned	flags;
+	size_t		valsize;
+	unsigned	growth;
+	size_t		growth_step;
+	unsigned	max_load;
+	unsigned	min_load;
+	size_t		shrink_delay;
+	unsigned	resize_threads;
+	const rhashmap_allocator_t *allocator;
+} rhashmap_params_t;
 
 rhashmap_t *	rhashmap_create(size_t, unsigned);
+rhashmap_t *	rhashmap_create_ex(const rhashmap_params_t *);
 void		rhashmap_destroy(rhashmap_t *);
+int		rhashmap_compact(rhashmap_t *);
+int		rhashmap_reserve(rhashmap_t *, size_t);
+int		rhashmap_compact_keys(rhashmap_t *, size_t);
+
+typedef void	(*rhashmap_clear_cb_t)(void *, size_t, void *, void *);
+void		rhashmap_clear(rhashmap_t *, rhashmap_clear_cb_t, void *);
 
 void *		rhashmap_get(rhashmap_t *, const void *, size_t);
 void *		rhashmap_put(rhashmap_t *, const void *, size_t, void *);
 void *		rhashmap_del(rhashmap_t *, const void *, size_t);
+const void *	rhashmap_intern(rhashmap_t *, const void *, size_t);
+
+void *		rhashmap_vget(rhashmap_t *, const void *, size_t);
+void *		rhashmap_vput(rhashmap_t *, const void *, size_t, const void *);
+int		rhashmap_vdel(rhashmap_t *, const void *, size_t, void *);
 
 #define	RHM_WALK_BEGIN		((uintmax_t)0)
 
 void *		rhashmap_walk(rhashmap_t *, uintmax_t *, size_t *, void **);
 
+rhashmap_t *	rhashmap_u64_create(size_t, unsigned);
+void *		rhashmap_u64_get(rhashmap_t *, uint64_t);
+void *		rhashmap_u64_put(rhashmap_t *, uint64_t, void *);
+void *		rhashmap_u64_del(rhashmap_t *, uint64_t);
+
+typedef struct rhashmap rhashset_t;
+
+rhashset_t *	rhashset_create(size_t, unsigned);
+void		rhashset_destroy(rhashset_t *);
+
+int		rhashset_has(rhashset_t *, const void *, size_t);
+int		rhashset_add(rhashset_t *, const void *, size_t);
+int		rhashset_del(rhashset_t *, const void *, size_t);
+
+rhashset_t *	rhashset_u64_create(size_t, unsigned);
+int		rhashset_u64_has(rhashset_t *, uint64_t);
+int		rhashset_u64_add(rhashset_t *, uint64_t);
+int		rhashset_u64_del(rhashset_t *, uint64_t);
+
 __END_DECLS
 
 #endif
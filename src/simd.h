@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2026 The rhashmap contributors
+ * All rights reserved.
+ *
+ * Use is subject to license terms, as specified in the LICENSE file.
+ */
+
+#ifndef	_SIMD_H_
+#define	_SIMD_H_
+
+#include <inttypes.h>
+
+/*
+ * Control byte group matching.
+ *
+ * A group is a run of consecutive control bytes which can be compared
+ * against a given byte value at once.  The result is a bit mask where
+ * the bit N is set if the byte N in the group matched.  AVX2 compares
+ * 32 bytes, SSE2 compares 16 bytes; the generic fallback compares 8
+ * bytes in a 64-bit word (SWAR).
+ */
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+#define	CTRL_GROUP_SIZE		32
+typedef uint32_t		ctrl_mask_t;
+
+static inline ctrl_mask_t
+ctrl_group_match(const uint8_t *ctrl, uint8_t c)
+{
+	const __m256i grp = _mm256_loadu_si256((const void *)ctrl);
+	const __m256i cmp = _mm256_cmpeq_epi8(grp, _mm256_set1_epi8((char)c));
+	return (ctrl_mask_t)_mm256_movemask_epi8(cmp);
+}
+
+#elif defined(__SSE2__)
+
+#include <emmintrin.h>
+
+#define	CTRL_GROUP_SIZE		16
+typedef uint32_t		ctrl_mask_t;
+
+static inline ctrl_mask_t
+ctrl_group_match(const uint8_t *ctrl, uint8_t c)
+{
+	const __m128i grp = _mm_loadu_si128((const void *)ctrl);
+	const __m128i cmp = _mm_cmpeq_epi8(grp, _mm_set1_epi8((char)c));
+	return (ctrl_mask_t)_mm_movemask_epi8(cmp);
+}
+
+#else
+
+#include <string.h>
+
+#define	CTRL_GROUP_SIZE		8
+typedef uint32_t		ctrl_mask_t;
+
+#define	SWAR_LSB		0x0101010101010101ULL
+#define	SWAR_LOW7		0x7f7f7f7f7f7f7f7fULL
+
+/*
+ * The matching bytes are XORed to zero; the zero bytes are then found
+ * exactly (without the carries of the usual "haszero" trick, which can
+ * falsely match a byte above a zero byte): the high bit of a byte stays
+ * clear only if all of its bits are clear.  The high bits are gathered
+ * into the mask by a multiplication.
+ */
+static inline ctrl_mask_t
+ctrl_group_match(const uint8_t *ctrl, uint8_t c)
+{
+	uint64_t grp, x, hi;
+
+	memcpy(&grp, ctrl, sizeof(grp));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	grp = __builtin_bswap64(grp);
+#endif
+	x = grp ^ (c * SWAR_LSB);
+	hi = ~(((x & SWAR_LOW7) + SWAR_LOW7) | x) & ~SWAR_LOW7;
+	return (ctrl_mask_t)(((hi >> 7) * 0x0102040810204080ULL) >> 56);
+}
+
+#endif
+
+/*
+ * ctrl_mask_first: return the index of the lowest set bit.
+ */
+static inline unsigned
+ctrl_mask_first(ctrl_mask_t mask)
+{
+	return (unsigned)__builtin_ctz(mask);
+}
+
+/*
+ * ctrl_mask_below: return the mask of bits below the n-th bit.
+ */
+static inline ctrl_mask_t
+ctrl_mask_below(unsigned n)
+{
+	return n >= CTRL_GROUP_SIZE ?
+	    (ctrl_mask_t)~0U : (ctrl_mask_t)((1ULL << n) - 1);
+}
+
+/*
+ * ctrl_fingerprint: return the 7-bit fingerprint of the hash for its
+ * control byte.
+ *
+ * => The fingerprint is the top seven bits of the (multiplicative) mix
+ *    of the low 32 bits of the hash.  The hash bits themselves cannot be
+ *    used: the remainder taken as the home slot nearly determines the
+ *    high bits of the 32-bit hash on the large tables, while the high
+ *    bits of the hash determine the home slot in the power-of-two tables.
+ *    The mix spreads the hashes of the nearby home slots (which differ in
+ *    a few low or a few high bits) across all fingerprints.
+ */
+#define	CTRL_FP_MUL		0x9e3779b1U
+
+static inline uint8_t
+ctrl_fingerprint(uint64_t hash)
+{
+	return (uint8_t)(((uint32_t)hash * CTRL_FP_MUL) >> 25);
+}
+
+#endif
@@ -111,3 +111,105 @@ halfsiphash(const uint8_t *in, const size_t inlen, const uint64_t k)
 	U32TO8_LE((uint8_t *)&m, b);
 	return m;
 }
+
+/*
+ * siphash24: the regular (64-bit) SipHash-2-4.
+ *
+ * => The 128-bit key is derived from the given 64-bit key, so that the
+ *    both variants take the same key (of the same strength).
+ */
+
+#define ROTL64(x, b)	(uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND64			\
+	do {				\
+		v0 += v1;		\
+		v1 = ROTL64(v1, 13);	\
+		v1 ^= v0;		\
+		v0 = ROTL64(v0, 32);	\
+		v2 += v3;		\
+		v3 = ROTL64(v3, 16);	\
+		v3 ^= v2;		\
+		v0 += v3;		\
+		v3 = ROTL64(v3, 21);	\
+		v3 ^= v0;		\
+		v2 += v1;		\
+		v1 = ROTL64(v1, 17);	\
+		v1 ^= v2;		\
+		v2 = ROTL64(v2, 32);	\
+	} while (0)
+
+#define U8TO64_LE(p)							\
+	((uint64_t)U8TO32_LE(p) | ((uint64_t)U8TO32_LE((p) + 4) << 32))
+
+uint64_t
+siphash24(const uint8_t *in, const size_t inlen, const uint64_t k)
+{
+	const uint8_t *end = in + inlen - (inlen % sizeof(uint64_t));
+	const unsigned left = inlen & 7;
+
+	uint64_t v0 = 0x736f6d6570736575ULL;
+	uint64_t v1 = 0x646f72616e646f6dULL;
+	uint64_t v2 = 0x6c7967656e657261ULL;
+	uint64_t v3 = 0x7465646279746573ULL;
+	uint64_t k0 = k;
+	uint64_t k1 = ~k;
+	uint64_t m;
+
+	uint64_t b = ((uint64_t)inlen) << 56;
+
+	v3 ^= k1;
+	v2 ^= k0;
+	v1 ^= k1;
+	v0 ^= k0;
+
+	for (; in != end; in += 8) {
+		m = U8TO64_LE(in);
+		v3 ^= m;
+		for (unsigned i = 0; i < cROUNDS; ++i) {
+			SIPROUND64;
+		}
+		v0 ^= m;
+	}
+
+	switch (left) {
+	case 7:
+		b |= ((uint64_t)in[6]) << 48;
+		/* FALLTHROUGH */
+	case 6:
+		b |= ((uint64_t)in[5]) << 40;
+		/* FALLTHROUGH */
+	case 5:
+		b |= ((uint64_t)in[4]) << 32;
+		/* FALLTHROUGH */
+	case 4:
+		b |= ((uint64_t)in[3]) << 24;
+		/* FALLTHROUGH */
+	case 3:
+		b |= ((uint64_t)in[2]) << 16;
+		/* FALLTHROUGH */
+	case 2:
+		b |= ((uint64_t)in[1]) << 8;
+		/* FALLTHROUGH */
+	case 1:
+		b |= ((uint64_t)in[0]);
+		break;
+	case 0:
+		break;
+	}
+
+	v3 ^= b;
+
+	for (unsigned i = 0; i < cROUNDS; ++i) {
+		SIPROUND64;
+	}
+
+	v0 ^= b;
+	v2 ^= 0xff;
+
+	for (unsigned i = 0; i < dROUNDS; ++i) {
+		SIPROUND64;
+	}
+
+	return v0 ^ v1 ^ v2 ^ v3;
+}
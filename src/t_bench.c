@@ -0,0 +1,1017 @@
+/*
+ * Copyright (c) 2026 The rhashmap contributors
+ * All rights reserved.
+ *
+ * Use is subject to license terms, as specified in the LICENSE file.
+ */
+
+/*
+ * Micro-benchmarks.  Usage:
+ *
+ *	t_bench [-n nitems] [benchmark ...]
+ *
+ * If no benchmark is specified, then all of them are run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "rhashmap.h"
+
+#define	NUM2PTR(x)	((void *)(uintptr_t)(x))
+
+#ifndef __arraycount
+#define	__arraycount(a)	(sizeof(a) / sizeof(a[0]))
+#endif
+
+static unsigned		bench_nitems = 0;
+
+static uint64_t
+now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * bench_key: return a unique pseudo-random key for the given index.
+ */
+static uint64_t
+bench_key(uint64_t i)
+{
+	i = (i ^ (i >> 31)) * 0x7fb5d329728ea185ULL;
+	return i ^ (i >> 27);
+}
+
+static unsigned
+bench_default_nitems(unsigned nitems)
+{
+	return bench_nitems ? bench_nitems : nitems;
+}
+
+static void
+bench_lookup(const char *name, unsigned size, unsigned nitems, unsigned flags)
+{
+	const unsigned nlookups = 8 * nitems;
+	uint64_t t, hit_ns, miss_ns;
+	rhashmap_t *hmap;
+	void *ret;
+
+	hmap = rhashmap_create(size, flags);
+	assert(hmap != NULL);
+
+	for (unsigned i = 0; i < nitems; i++) {
+		const uint64_t key = bench_key(i);
+		ret = rhashmap_put(hmap, &key, sizeof(key), NUM2PTR(i + 1));
+		assert(ret == NUM2PTR(i + 1));
+	}
+
+	t = now_nsec();
+	for (unsigned i = 0; i < nlookups; i++) {
+		const uint64_t key = bench_key(i % nitems);
+		ret = rhashmap_get(hmap, &key, sizeof(key));
+		assert(ret != NULL);
+	}
+	hit_ns = now_nsec() - t;
+
+	t = now_nsec();
+	for (unsigned i = 0; i < nlookups; i++) {
+		const uint64_t key = bench_key(nitems + i);
+		ret = rhashmap_get(hmap, &key, sizeof(key));
+		assert(ret == NULL);
+	}
+	miss_ns = now_nsec() - t;
+	(void)ret;
+
+	printf("%-24s %10u %10u %8.2f %8.2f\n", name, size, nitems,
+	    (double)hit_ns / nlookups, (double)miss_ns / nlookups);
+	rhashmap_destroy(hmap);
+}
+
+/*
+ * bench_probe: compare the cost of the probe arithmetic -- arbitrary
+ * sizes (fast remainder) against the power-of-two sizes (shift/mask).
+ * Both tables have the same size and load factor (80%).
+ */
+static void
+bench_probe(void)
+{
+	const unsigned n = bench_default_nitems(1024 * 1024);
+	unsigned size = 1, nitems;
+
+	while (size < n) {
+		size <<= 1;
+	}
+	nitems = (unsigned)((uint64_t)size * 80 / 100);
+
+	printf("%-24s %10s %10s %8s %8s\n",
+	    "probe", "size", "nitems", "hit-ns", "miss-ns");
+	bench_lookup("arbitrary-size", size, nitems, RHM_NONCRYPTO);
+	bench_lookup("power-of-two", size, nitems, RHM_NONCRYPTO | RHM_POW2);
+	bench_lookup("arbitrary-size (odd)", size - 3, nitems - 3,
+	    RHM_NONCRYPTO);
+}
+
+/*
+ * bench_hugepage: compare the random lookup throughput with the arrays
+ * on the regular (4K) pages and on the huge pages, at 1M, 16M and 128M
+ * elements (or the given number of elements).
+ */
+static void
+bench_hugepage(void)
+{
+	static const unsigned sizes[] = {
+		1U << 20, 16U << 20, 128U << 20,
+	};
+	const unsigned nsizes = bench_nitems ? 1 : __arraycount(sizes);
+
+	printf("%-24s %10s %10s %8s %8s\n",
+	    "hugepage", "size", "nitems", "hit-ns", "miss-ns");
+	for (unsigned i = 0; i < nsizes; i++) {
+		const unsigned nitems = bench_default_nitems(sizes[i]);
+		const unsigned size = nitems / 4 * 5; // 80% load
+
+		bench_lookup("4K-pages", size, nitems, RHM_NONCRYPTO);
+		bench_lookup("huge-pages", size, nitems,
+		    RHM_NONCRYPTO | RHM_HUGEPAGE);
+	}
+}
+
+/*
+ * bench_wide: compare the lookup in the compact (32-bit hash) table
+ * against the wide (64-bit hash and sizes) one.
+ */
+static void
+bench_wide(void)
+{
+	const unsigned nitems = bench_default_nitems(4 * 1024 * 1024);
+	const unsigned size = nitems / 4 * 5; // 80% load
+
+	printf("%-24s %10s %10s %8s %8s\n",
+	    "wide", "size", "nitems", "hit-ns", "miss-ns");
+	bench_lookup("compact", size, nitems, RHM_NONCRYPTO);
+	bench_lookup("wide", size, nitems, RHM_NONCRYPTO | RHM_WIDE);
+	bench_lookup("compact (siphash)", size, nitems, 0);
+	bench_lookup("wide (siphash)", size, nitems, RHM_WIDE);
+}
+
+/*
+ * bench_grow: measure the insert throughput into an empty map, i.e.
+ * including all of the resizes, with the short (inline) and the long
+ * (copied, out of line) keys.
+ */
+static void
+bench_grow(void)
+{
+	const unsigned nitems = bench_default_nitems(4 * 1024 * 1024);
+
+	printf("%-24s %10s %8s\n", "grow", "nitems", "put-ns");
+	for (unsigned klen = 8; klen <= 32; klen += 24) {
+		rhashmap_t *hmap;
+		uint64_t key[4] = { 0, 0, 0, 0 }, t;
+		char name[32];
+
+		hmap = rhashmap_create(0, 0);
+		assert(hmap != NULL);
+
+		t = now_nsec();
+		for (unsigned i = 0; i < nitems; i++) {
+			key[0] = bench_key(i);
+			rhashmap_put(hmap, key, klen, NUM2PTR(1));
+		}
+		t = now_nsec() - t;
+
+		snprintf(name, sizeof(name), "%u-byte keys", klen);
+		printf("%-24s %10u %8.2f\n", name, nitems, (double)t / nitems);
+		rhashmap_destroy(hmap);
+	}
+}
+
+/*
+ * bench_u64: compare the lookup of the 64-bit integer keys using the
+ * regular interface against the specialised rhashmap_u64_* interface.
+ */
+static void
+bench_u64(void)
+{
+	const unsigned nitems = bench_default_nitems(1024 * 1024);
+	const unsigned nlookups = 8 * nitems;
+	rhashmap_t *hmap, *u64map;
+	uint64_t t, bytes_ns, u64_ns;
+	void *ret;
+
+	hmap = rhashmap_create(0, RHM_NONCRYPTO);
+	assert(hmap != NULL);
+
+	u64map = rhashmap_u64_create(0, 0);
+	assert(u64map != NULL);
+
+	for (unsigned i = 0; i < nitems; i++) {
+		const uint64_t key = bench_key(i);
+
+		ret = rhashmap_put(hmap, &key, sizeof(key), NUM2PTR(i + 1));
+		assert(ret == NUM2PTR(i + 1));
+		ret = rhashmap_u64_put(u64map, key, NUM2PTR(i + 1));
+		assert(ret == NUM2PTR(i + 1));
+	}
+
+	t = now_nsec();
+	for (unsigned i = 0; i < nlookups; i++) {
+		const uint64_t key = bench_key(i % nitems);
+		ret = rhashmap_get(hmap, &key, sizeof(key));
+		assert(ret != NULL);
+	}
+	bytes_ns = now_nsec() - t;
+
+	t = now_nsec();
+	for (unsigned i = 0; i < nlookups; i++) {
+		ret = rhashmap_u64_get(u64map, bench_key(i % nitems));
+		assert(ret != NULL);
+	}
+	u64_ns = now_nsec() - t;
+	(void)ret;
+
+	printf("%-24s %10s %8s\n", "u64", "nitems", "hit-ns");
+	printf("%-24s %10u %8.2f\n", "bytes (murmurhash3)",
+	    nitems, (double)bytes_ns / nlookups);
+	printf("%-24s %10u %8.2f\n", "u64 (mixer)",
+	    nitems, (double)u64_ns / nlookups);
+
+	rhashmap_destroy(hmap);
+	rhashmap_destroy(u64map);
+}
+
+/*
+ * bench_set: compare the membership checks in a map (with the dummy
+ * values) against the sets, which have no value storage.
+ */
+static void
+bench_set(void)
+{
+	const unsigned nitems = bench_default_nitems(4 * 1024 * 1024);
+	const unsigned nlookups = 4 * nitems;
+	rhashset_t *hset, *u64set;
+	rhashmap_t *hmap;
+	uint64_t t, map_ns, set_ns, u64set_ns;
+	int ret = 0;
+
+	hmap = rhashmap_create(0, RHM_NONCRYPTO);
+	assert(hmap != NULL);
+	hset = rhashset_create(0, RHM_NONCRYPTO);
+	assert(hset != NULL);
+	u64set = rhashset_u64_create(0, 0);
+	assert(u64set != NULL);
+
+	for (unsigned i = 0; i < nitems; i++) {
+		const uint64_t key = bench_key(i);
+
+		rhashmap_put(hmap, &key, sizeof(key), NUM2PTR(1));
+		ret = rhashset_add(hset, &key, sizeof(key));
+		assert(ret == 1);
+		ret = rhashset_u64_add(u64set, key);
+		assert(ret == 1);
+	}
+
+	t = now_nsec();
+	for (unsigned i = 0; i < nlookups; i++) {
+		const uint64_t key = bench_key(i % (2 * nitems));
+		ret += rhashmap_get(hmap, &key, sizeof(key)) != NULL;
+	}
+	map_ns = now_nsec() - t;
+
+	t = now_nsec();
+	for (unsigned i = 0; i < nlookups; i++) {
+		const uint64_t key = bench_key(i % (2 * nitems));
+		ret += rhashset_has(hset, &key, sizeof(key));
+	}
+	set_ns = now_nsec() - t;
+
+	t = now_nsec();
+	for (unsigned i = 0; i < nlookups; i++) {
+		ret += rhashset_u64_has(u64set, bench_key(i % (2 * nitems)));
+	}
+	u64set_ns = now_nsec() - t;
+	assert(ret == 1 + 3 * (int)(nlookups / 2));
+
+	printf("%-24s %10s %8s\n", "set", "nitems", "has-ns");
+	printf("%-24s %10u %8.2f\n", "map (dummy values)",
+	    nitems, (double)map_ns / nlookups);
+	printf("%-24s %10u %8.2f\n", "set",
+	    nitems, (double)set_ns / nlookups);
+	printf("%-24s %10u %8.2f\n", "set (u64 keys)",
+	    nitems, (double)u64set_ns / nlookups);
+
+	rhashmap_destroy(hmap);
+	rhashset_destroy(hset);
+	rhashset_destroy(u64set);
+}
+
+/*
+ * bench_vals: compare the counters kept behind the value pointers (a
+ * separate allocation per counter) against the counters stored in the
+ * map by copy.
+ */
+static void
+bench_vals(void)
+{
+	const unsigned nitems = bench_default_nitems(1024 * 1024);
+	const unsigned nupdates = 8 * nitems;
+	const rhashmap_params_t params = {
+		.flags = RHM_NONCRYPTO, .valsize = sizeof(uint64_t)
+	};
+	rhashmap_t *hmap, *vmap;
+	uint64_t t, ptr_ns, copy_ns, *cnt;
+
+	hmap = rhashmap_create(0, RHM_NONCRYPTO);
+	assert(hmap != NULL);
+	vmap = rhashmap_create_ex(&params);
+	assert(vmap != NULL);
+
+	for (unsigned i = 0; i < nitems; i++) {
+		const uint64_t key = bench_key(i);
+
+		cnt = calloc(1, sizeof(uint64_t));
+		assert(cnt != NULL);
+		rhashmap_put(hmap, &key, sizeof(key), cnt);
+		rhashmap_vput(vmap, &key, sizeof(key), NULL);
+	}
+
+	t = now_nsec();
+	for (unsigned i = 0; i < nupdates; i++) {
+		const uint64_t key = bench_key(i % nitems);
+		cnt = rhashmap_get(hmap, &key, sizeof(key));
+		(*cnt)++;
+	}
+	ptr_ns = now_nsec() - t;
+
+	t = now_nsec();
+	for (unsigned i = 0; i < nupdates; i++) {
+		const uint64_t key = bench_key(i % nitems);
+		cnt = rhashmap_vget(vmap, &key, sizeof(key));
+		(*cnt)++;
+	}
+	copy_ns = now_nsec() - t;
+
+	printf("%-24s %10s %8s\n", "vals", "nitems", "inc-ns");
+	printf("%-24s %10u %8.2f\n", "pointer (malloc)",
+	    nitems, (double)ptr_ns / nupdates);
+	printf("%-24s %10u %8.2f\n", "by copy",
+	    nitems, (double)copy_ns / nupdates);
+
+	for (unsigned i = 0; i < nitems; i++) {
+		const uint64_t key = bench_key(i);
+		free(rhashmap_del(hmap, &key, sizeof(key)));
+	}
+	rhashmap_destroy(hmap);
+	rhashmap_destroy(vmap);
+}
+
+/*
+ * bench_load: measure the time to load the keys into an empty map under
+ * the different growth policies or with the capacity reserved upfront.
+ * The default policy grows linearly past MAX_GROWTH_STEP buckets; the
+ * difference shows on the large loads, e.g.
+ * "-n 100000000" (which needs over 10 GB of memory).
+ */
+static void
+bench_load(void)
+{
+	const unsigned nitems = bench_default_nitems(16 * 1024 * 1024);
+	const struct {
+		const char *		name;
+		rhashmap_params_t	params;
+		bool			reserve;
+	} policies[] = {
+		{ "default",		{ .flags = RHM_NONCRYPTO }, false },
+		{ "geometric 1.5x",	{ .flags = RHM_NONCRYPTO,
+					  .growth = 150 }, false },
+		{ "geometric 2x",	{ .flags = RHM_NONCRYPTO,
+					  .growth = 200 }, false },
+		{ "geometric 4x",	{ .flags = RHM_NONCRYPTO, .growth = 400,
+					  .max_load = 90 }, false },
+		{ "reserved",		{ .flags = RHM_NONCRYPTO }, true },
+	};
+
+	printf("%-24s %10s %8s %8s\n", "load", "nitems", "put-ns", "total-s");
+	for (unsigned p = 0; p < __arraycount(policies); p++) {
+		rhashmap_t *hmap;
+		uint64_t t;
+
+		hmap = rhashmap_create_ex(&policies[p].params);
+		assert(hmap != NULL);
+
+		t = now_nsec();
+		if (policies[p].reserve) {
+			rhashmap_reserve(hmap, nitems);
+		}
+		for (unsigned i = 0; i < nitems; i++) {
+			const uint64_t key = bench_key(i);
+			rhashmap_put(hmap, &key, sizeof(key), NUM2PTR(1));
+		}
+		t = now_nsec() - t;
+
+		printf("%-24s %10u %8.2f %8.2f\n", policies[p].name, nitems,
+		    (double)t / nitems, (double)t / 1000000000);
+		rhashmap_destroy(hmap);
+	}
+}
+
+/*
+ * bench_latency: measure the latency distribution of the individual puts
+ * into an empty map, comparing the resize in one go against the
+ * incremental and the background resize.
+ */
+static int
+cmp_u64(const void *a, const void *b)
+{
+	const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void
+bench_latency(void)
+{
+	const unsigned nitems = bench_default_nitems(4 * 1024 * 1024);
+	const struct {
+		const char *	name;
+		unsigned	flags;
+	} modes[] = {
+		{ "default",		0		},
+		{ "incremental",	RHM_INCREMENTAL	},
+		{ "background",		RHM_BACKGROUND	},
+	};
+	uint64_t *lat;
+
+	lat = malloc(nitems * sizeof(uint64_t));
+	assert(lat != NULL);
+
+	printf("%-24s %10s %8s %8s %10s %10s\n", "latency",
+	    "nitems", "mean-ns", "p99-ns", "p99.99-ns", "max-ns");
+	for (unsigned m = 0; m < __arraycount(modes); m++) {
+		rhashmap_t *hmap;
+		uint64_t total = 0;
+
+		hmap = rhashmap_create(0, RHM_NONCRYPTO | modes[m].flags);
+		assert(hmap != NULL);
+
+		for (unsigned i = 0; i < nitems; i++) {
+			const uint64_t key = bench_key(i);
+			uint64_t t = now_nsec();
+
+			rhashmap_put(hmap, &key, sizeof(key), NUM2PTR(1));
+			lat[i] = now_nsec() - t;
+			total += lat[i];
+		}
+		qsort(lat, nitems, sizeof(uint64_t), cmp_u64);
+
+		printf("%-24s %10u %8.2f %8" PRIu64 " %10" PRIu64
+		    " %10" PRIu64 "\n", modes[m].name,
+		    nitems, (double)total / nitems,
+		    lat[(uint64_t)nitems * 99 / 100],
+		    lat[(uint64_t)nitems * 9999 / 10000], lat[nitems - 1]);
+		rhashmap_destroy(hmap);
+	}
+	free(lat);
+}
+
+/*
+ * bench_inplace: compare the growth of the power-of-two sized tables,
+ * which double in place, against the tables which are resized into a
+ * new allocation.  Each case runs in a child process, to measure its
+ * peak RSS.
+ */
+static void
+bench_inplace(void)
+{
+	const unsigned nitems = bench_default_nitems(16 * 1024 * 1024);
+	const struct {
+		const char *		name;
+		rhashmap_params_t	params;
+	} cases[] = {
+		{ "copy (2x)",		{ .flags = RHM_NONCRYPTO,
+					  .growth = 200 } },
+		{ "in place (pow2)",	{ .flags = RHM_NONCRYPTO | RHM_POW2 } },
+	};
+
+	printf("%-24s %10s %8s %10s\n", "inplace", "nitems", "put-ns",
+	    "maxrss-MB");
+	fflush(stdout);
+
+	for (unsigned c = 0; c < __arraycount(cases); c++) {
+		struct rusage ru;
+		rhashmap_t *hmap;
+		uint64_t t;
+		pid_t pid;
+
+		if ((pid = fork()) != 0) {
+			assert(pid != -1);
+			waitpid(pid, NULL, 0);
+			continue;
+		}
+		hmap = rhashmap_create_ex(&cases[c].params);
+		assert(hmap != NULL);
+
+		t = now_nsec();
+		for (unsigned i = 0; i < nitems; i++) {
+			const uint64_t key = bench_key(i);
+			rhashmap_put(hmap, &key, sizeof(key), NUM2PTR(1));
+		}
+		t = now_nsec() - t;
+
+		getrusage(RUSAGE_SELF, &ru);
+		printf("%-24s %10u %8.2f %10ld\n", cases[c].name, nitems,
+		    (double)t / nitems, ru.ru_maxrss / 1024);
+		rhashmap_destroy(hmap);
+		exit(EXIT_SUCCESS);
+	}
+}
+
+/*
+ * bench_empty: create many small hash maps, most of which stay empty
+ * (e.g. per-connection maps), and measure the time per map and the
+ * peak RSS (in a child process).
+ */
+static void
+bench_empty(void)
+{
+	const unsigned nmaps = bench_default_nitems(1024 * 1024);
+	rhashmap_t **maps;
+	struct rusage ru;
+	uint64_t t;
+	pid_t pid;
+
+	printf("%-24s %10s %8s %10s\n", "empty", "nmaps", "map-ns",
+	    "maxrss-MB");
+	fflush(stdout);
+
+	if ((pid = fork()) != 0) {
+		assert(pid != -1);
+		waitpid(pid, NULL, 0);
+		return;
+	}
+	maps = calloc(nmaps, sizeof(rhashmap_t *));
+	assert(maps != NULL);
+
+	/* Every tenth map gets a few keys. */
+	t = now_nsec();
+	for (unsigned i = 0; i < nmaps; i++) {
+		maps[i] = rhashmap_create(0, RHM_NONCRYPTO);
+		assert(maps[i] != NULL);
+
+		for (uint64_t k = 0; i % 10 == 0 && k < 3; k++) {
+			rhashmap_put(maps[i], &k, sizeof(k), NUM2PTR(1));
+		}
+		rhashmap_get(maps[i], &i, sizeof(i));
+	}
+	for (unsigned i = 0; i < nmaps; i++) {
+		rhashmap_destroy(maps[i]);
+	}
+	t = now_nsec() - t;
+
+	getrusage(RUSAGE_SELF, &ru);
+	printf("%-24s %10u %8.2f %10ld\n", "10% used", nmaps,
+	    (double)t / nmaps, ru.ru_maxrss / 1024);
+	free(maps);
+	exit(EXIT_SUCCESS);
+}
+
+/*
+ * bench_parallel: measure a single resize (growing the table to about
+ * three times the items) against the number of resize threads.
+ */
+static void
+bench_parallel(void)
+{
+	const unsigned nitems = bench_default_nitems(8 * 1024 * 1024);
+	const unsigned threads[] = { 1, 2, 4, 8, 16 };
+	uint64_t base = 0;
+
+	printf("%-24s %10s %10s %8s (%ld CPUs)\n", "parallel", "nitems",
+	    "resize-ms", "speedup", sysconf(_SC_NPROCESSORS_ONLN));
+	for (unsigned c = 0; c < __arraycount(threads); c++) {
+		const rhashmap_params_t params = {
+			.flags = RHM_NONCRYPTO, .resize_threads = threads[c]
+		};
+		rhashmap_t *hmap;
+		uint64_t t;
+		char name[32];
+
+		hmap = rhashmap_create_ex(&params);
+		assert(hmap != NULL);
+
+		for (unsigned i = 0; i < nitems; i++) {
+			const uint64_t key = bench_key(i);
+			rhashmap_put(hmap, &key, sizeof(key), NUM2PTR(1));
+		}
+		t = now_nsec();
+		rhashmap_reserve(hmap, (size_t)nitems * 3);
+		t = now_nsec() - t;
+		base = base ? base : t;
+
+		snprintf(name, sizeof(name), "%u thread(s)", threads[c]);
+		printf("%-24s %10u %10.2f %8.2f\n", name, nitems,
+		    (double)t / 1000000, (double)base / t);
+		rhashmap_destroy(hmap);
+	}
+}
+
+/*
+ * bench_clear: load the batches of keys into a map and reset it after
+ * each batch, either re-creating the map or clearing it.
+ */
+static void
+bench_clear(void)
+{
+	const unsigned nitems = bench_default_nitems(1024 * 1024);
+	const unsigned nbatches = 8;
+
+	printf("%-24s %10s %10s\n", "clear", "nitems", "batch-ms");
+	for (unsigned c = 0; c < 2; c++) {
+		rhashmap_t *hmap;
+		uint64_t t;
+
+		hmap = rhashmap_create(0, RHM_NONCRYPTO);
+		assert(hmap != NULL);
+
+		t = now_nsec();
+		for (unsigned b = 0; b < nbatches; b++) {
+			for (unsigned i = 0; i < nitems; i++) {
+				const uint64_t key = bench_key(i);
+				rhashmap_put(hmap, &key, sizeof(key),
+				    NUM2PTR(1));
+			}
+			if (c == 0) {
+				rhashmap_destroy(hmap);
+				hmap = rhashmap_create(0, RHM_NONCRYPTO);
+				assert(hmap != NULL);
+			} else {
+				rhashmap_clear(hmap, NULL, NULL);
+			}
+		}
+		t = now_nsec() - t;
+
+		printf("%-24s %10u %10.2f\n", c ? "clear" : "destroy/create",
+		    nitems, (double)t / nbatches / 1000000);
+		rhashmap_destroy(hmap);
+	}
+}
+
+/*
+ * bench_keys: measure the inserts, deletes (with re-inserts) and the
+ * destruction of a map with the copied 24-byte keys, and the peak RSS
+ * (in a child process).
+ */
+static void
+bench_keys(void)
+{
+	const unsigned nitems = bench_default_nitems(4 * 1024 * 1024);
+	uint64_t t, put_ns, churn_ns, destroy_ns;
+	rhashmap_t *hmap;
+	struct rusage ru;
+	uint64_t key[3];
+	pid_t pid;
+
+	printf("%-24s %10s %8s %8s %10s %10s\n", "keys", "nitems",
+	    "put-ns", "churn-ns", "destroy-ms", "maxrss-MB");
+	fflush(stdout);
+
+	if ((pid = fork()) != 0) {
+		assert(pid != -1);
+		waitpid(pid, NULL, 0);
+		return;
+	}
+	hmap = rhashmap_create(0, RHM_NONCRYPTO);
+	assert(hmap != NULL);
+
+	t = now_nsec();
+	for (unsigned i = 0; i < nitems; i++) {
+		key[0] = key[1] = key[2] = bench_key(i);
+		rhashmap_put(hmap, key, sizeof(key), NUM2PTR(1));
+	}
+	put_ns = now_nsec() - t;
+
+	/* Churn: delete and re-insert every other key. */
+	t = now_nsec();
+	for (unsigned i = 0; i < nitems; i += 2) {
+		key[0] = key[1] = key[2] = bench_key(i);
+		rhashmap_del(hmap, key, sizeof(key));
+	}
+	for (unsigned i = 0; i < nitems; i += 2) {
+		key[0] = key[1] = key[2] = bench_key(i);
+		rhashmap_put(hmap, key, sizeof(key), NUM2PTR(1));
+	}
+	churn_ns = now_nsec() - t;
+
+	t = now_nsec();
+	rhashmap_destroy(hmap);
+	destroy_ns = now_nsec() - t;
+
+	getrusage(RUSAGE_SELF, &ru);
+	printf("%-24s %10u %8.2f %8.2f %10.2f %10ld\n", "24-byte keys",
+	    nitems, (double)put_ns / nitems, (double)churn_ns / nitems,
+	    (double)destroy_ns / 1000000, ru.ru_maxrss / 1024);
+	exit(EXIT_SUCCESS);
+}
+
+/*
+ * bench_compact_keys: scatter the 40-byte key copies by the churn in
+ * a random order, then measure the walk (reading the keys) and random
+ * lookups, before and after the key compaction.
+ */
+static void
+bench_compact_keys(void)
+{
+	const unsigned nitems = bench_default_nitems(2 * 1024 * 1024);
+	const unsigned nlookups = 4 * nitems;
+	uint64_t key[5], t, walk_ns, get_ns, sum = 0;
+	rhashmap_t *hmap;
+
+	hmap = rhashmap_create(0, RHM_NONCRYPTO);
+	assert(hmap != NULL);
+
+	for (unsigned i = 0; i < nitems; i++) {
+		key[0] = key[1] = key[2] = key[3] = key[4] = bench_key(i);
+		rhashmap_put(hmap, key, sizeof(key), NUM2PTR(1));
+	}
+
+	/*
+	 * Churn: delete and re-insert the random keys, so that they take
+	 * the freed space of each other.
+	 */
+	for (unsigned r = 1; r < 4; r++) {
+		for (unsigned j = 0; j < nitems / 2; j++) {
+			const uint64_t i = bench_key(r * nitems + j) % nitems;
+
+			key[0] = key[1] = key[2] = key[3] = key[4] =
+			    bench_key(i);
+			rhashmap_del(hmap, key, sizeof(key));
+		}
+		for (unsigned j = 0; j < nitems / 2; j++) {
+			const uint64_t i = bench_key(r * nitems + j) % nitems;
+
+			key[0] = key[1] = key[2] = key[3] = key[4] =
+			    bench_key(i);
+			rhashmap_put(hmap, key, sizeof(key), NUM2PTR(1));
+		}
+	}
+
+	printf("%-24s %10s %8s %8s\n", "compact", "nitems", "walk-ns",
+	    "get-ns");
+	for (unsigned c = 0; c < 2; c++) {
+		uintmax_t iter = RHM_WALK_BEGIN;
+		const uint64_t *k;
+		size_t len;
+
+		if (c) {
+			t = now_nsec();
+			rhashmap_compact_keys(hmap, 0);
+			t = now_nsec() - t;
+			printf("%-24s %10u %8.2f ms\n", "compaction", nitems,
+			    (double)t / 1000000);
+		}
+
+		t = now_nsec();
+		while ((k = rhashmap_walk(hmap, &iter, &len, NULL)) != NULL) {
+			sum += k[len / sizeof(uint64_t) - 1];
+		}
+		walk_ns = now_nsec() - t;
+
+		t = now_nsec();
+		for (unsigned j = 0; j < nlookups; j++) {
+			key[0] = key[1] = key[2] = key[3] = key[4] =
+			    bench_key(bench_key(j) % nitems);
+			sum += (uintptr_t)rhashmap_get(hmap, key, sizeof(key));
+		}
+		get_ns = now_nsec() - t;
+
+		printf("%-24s %10u %8.2f %8.2f\n", c ? "after" : "before",
+		    nitems, (double)walk_ns / nitems,
+		    (double)get_ns / nlookups);
+	}
+	assert(sum != 0);
+	rhashmap_destroy(hmap);
+}
+
+/*
+ * bench_intern: intern the symbols (each four times), either using the
+ * interning set or keeping a separate copy as the value of a map, and
+ * measure the time per operation and the peak RSS (in a child process).
+ */
+static void
+bench_intern(void)
+{
+	const unsigned nitems = bench_default_nitems(2 * 1024 * 1024);
+	const unsigned nops = 4 * nitems;
+
+	printf("%-24s %10s %8s %10s\n", "intern", "nitems", "op-ns",
+	    "maxrss-MB");
+	fflush(stdout);
+
+	for (unsigned c = 0; c < 2; c++) {
+		rhashmap_t *hmap;
+		struct rusage ru;
+		char sym[32];
+		uint64_t t;
+		pid_t pid;
+
+		if ((pid = fork()) != 0) {
+			assert(pid != -1);
+			waitpid(pid, NULL, 0);
+			continue;
+		}
+		hmap = c ? rhashset_create(0, RHM_NONCRYPTO | RHM_INTERN) :
+		    rhashmap_create(0, RHM_NONCRYPTO);
+		assert(hmap != NULL);
+
+		t = now_nsec();
+		for (unsigned i = 0; i < nops; i++) {
+			const size_t len = (size_t)snprintf(sym, sizeof(sym),
+			    "sym_%" PRIx64, bench_key(i % nitems));
+			const void *p;
+			char *copy;
+
+			if (c) {
+				p = rhashmap_intern(hmap, sym, len);
+			} else if ((p = rhashmap_get(hmap, sym, len)) == NULL) {
+				copy = malloc(len);
+				memcpy(copy, sym, len);
+				p = rhashmap_put(hmap, sym, len, copy);
+			}
+			assert(p != NULL);
+		}
+		t = now_nsec() - t;
+
+		getrusage(RUSAGE_SELF, &ru);
+		printf("%-24s %10u %8.2f %10ld\n",
+		    c ? "interning set" : "map + own copy", nitems,
+		    (double)t / nops, ru.ru_maxrss / 1024);
+		exit(EXIT_SUCCESS);
+	}
+}
+
+typedef struct {
+	rhashmap_t *	hmap;
+	unsigned	nitems;
+	unsigned	seed;
+	unsigned	nlookups;
+	pthread_t	thread;
+} bench_reader_t;
+
+static void *
+bench_reader(void *arg)
+{
+	bench_reader_t *r = arg;
+	void *ret;
+
+	for (unsigned i = 0; i < r->nlookups; i++) {
+		const uint64_t key = bench_key(bench_key(r->seed + i) %
+		    r->nitems);
+		ret = rhashmap_get(r->hmap, &key, sizeof(key));
+		assert(ret != NULL);
+	}
+	(void)ret;
+	return NULL;
+}
+
+/*
+ * bench_numa: random lookups by the concurrent reader threads (one per
+ * CPU) in a table populated by a single thread, i.e. with the arrays on
+ * its memory node (first touch), against the interleaved arrays.  On a
+ * single node machine, both variants are expected to perform the same.
+ */
+static void
+bench_numa(void)
+{
+	const unsigned nitems = bench_default_nitems(16 * 1024 * 1024);
+	const unsigned size = nitems / 4 * 5; // 80% load
+	const long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	const unsigned nthreads = ncpus > 0 ? (unsigned)ncpus : 1;
+	const unsigned nlookups = 4 * 1024 * 1024;
+	bench_reader_t *readers;
+
+	readers = calloc(nthreads, sizeof(bench_reader_t));
+	assert(readers != NULL);
+
+	printf("%-24s %10s %10s %8s %10s\n", "numa", "nitems", "threads",
+	    "hit-ns", "Mlookup/s");
+	for (unsigned c = 0; c < 2; c++) {
+		const unsigned flags = RHM_NONCRYPTO | (c ? RHM_NUMA : 0);
+		rhashmap_t *hmap;
+		uint64_t t;
+
+		hmap = rhashmap_create(size, flags);
+		assert(hmap != NULL);
+
+		for (unsigned i = 0; i < nitems; i++) {
+			const uint64_t key = bench_key(i);
+			rhashmap_put(hmap, &key, sizeof(key), NUM2PTR(1));
+		}
+
+		t = now_nsec();
+		for (unsigned i = 0; i < nthreads; i++) {
+			bench_reader_t *r = &readers[i];
+
+			r->hmap = hmap;
+			r->nitems = nitems;
+			r->seed = i * nlookups;
+			r->nlookups = nlookups;
+			pthread_create(&r->thread, NULL, bench_reader, r);
+		}
+		for (unsigned i = 0; i < nthreads; i++) {
+			pthread_join(readers[i].thread, NULL);
+		}
+		t = now_nsec() - t;
+
+		printf("%-24s %10u %10u %8.2f %10.2f\n",
+		    c ? "interleaved" : "first-touch", nitems, nthreads,
+		    (double)t / nlookups,
+		    (double)nlookups * nthreads * 1000 / t);
+		rhashmap_destroy(hmap);
+	}
+	free(readers);
+}
+
+static const struct {
+	const char *	name;
+	void		(*func)(void);
+} benchmarks[] = {
+	{ "probe",	bench_probe	},
+	{ "hugepage",	bench_hugepage	},
+	{ "wide",	bench_wide	},
+	{ "grow",	bench_grow	},
+	{ "u64",	bench_u64	},
+	{ "set",	bench_set	},
+	{ "vals",	bench_vals	},
+	{ "latency",	bench_latency	},
+	{ "load",	bench_load	},
+	{ "inplace",	bench_inplace	},
+	{ "parallel",	bench_parallel	},
+	{ "empty",	bench_empty	},
+	{ "clear",	bench_clear	},
+	{ "keys",	bench_keys	},
+	{ "compact",	bench_compact_keys },
+	{ "intern",	bench_intern	},
+	{ "numa",	bench_numa	},
+};
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n nitems] [benchmark ...]\n", prog);
+	fprintf(stderr, "Benchmarks:");
+	for (unsigned i = 0; i < __arraycount(benchmarks); i++) {
+		fprintf(stderr, " %s", benchmarks[i].name);
+	}
+	fputc('\n', stderr);
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv)
+{
+	int ch;
+
+	while ((ch = getopt(argc, argv, "n:")) != -1) {
+		switch (ch) {
+		case 'n':
+			bench_nitems = (unsigned)strtoul(optarg, NULL, 10);
+			if (bench_nitems == 0) {
+				usage(argv[0]);
+			}
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind == argc) {
+		for (unsigned i = 0; i < __arraycount(benchmarks); i++) {
+			benchmarks[i].func();
+		}
+		return 0;
+	}
+	for (int j = optind; j < argc; j++) {
+		unsigned i;
+
+		for (i = 0; i < __arraycount(benchmarks); i++) {
+			if (strcmp(argv[j], benchmarks[i].name) == 0)
+				break;
+		}
+		if (i == __arraycount(benchmarks)) {
+			usage(argv[0]);
+		}
+		benchmarks[i].func();
+	}
+	return 0;
+}
@@ -7,14 +7,78 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
+#include <unistd.h>
 #include <inttypes.h>
+#include <stdatomic.h>
 #include <assert.h>
 
 #include "rhashmap.h"
+#include "fastdiv.h"
+#include "simd.h"
 
 #define	NUM2PTR(x)	((void *)(uintptr_t)(x))
 
+#ifndef __arraycount
+#define	__arraycount(a)	(sizeof(a) / sizeof(a[0]))
+#endif
+
+/*
+ * fp_spread: return the number of distinct fingerprints of all 32-bit
+ * hashes with the home slot (the remainder, as in the compact tables of
+ * arbitrary size) in the given window.
+ */
+static unsigned
+fp_spread(uint32_t size, uint32_t start, uint32_t window)
+{
+	const uint64_t divinfo = fast_div32_init(size);
+	bool seen[128];
+	unsigned nfp = 0;
+
+	memset(seen, 0, sizeof(seen));
+	for (uint32_t r = start; r < start + window; r++) {
+		for (uint64_t hash = r; hash <= UINT32_MAX; hash += size) {
+			const uint8_t fp = ctrl_fingerprint(hash);
+
+			assert(fast_rem32((uint32_t)hash, size, divinfo) == r);
+			assert(fp < __arraycount(seen));
+			nfp += !seen[fp];
+			seen[fp] = true;
+		}
+	}
+	return nfp;
+}
+
+/*
+ * test_fp_spread: the fingerprints of the hashes with the nearby home
+ * slots must differ, even on the large tables of arbitrary size, where
+ * the remainder nearly determines the high bits of the hash.
+ */
+static void
+test_fp_spread(void)
+{
+	static const struct {
+		uint32_t size;
+		unsigned min_fp;
+	} cases[] = {
+		{ 1000003,		128 },	// ~4K hashes per slot
+		{ 50000017,		128 },	// ~86 hashes per slot
+		{ 1500000001,		48 },	// 2-3 hashes per slot
+		{ 3000000019,		24 },	// 1-2 hashes per slot
+	};
+
+	for (unsigned c = 0; c < __arraycount(cases); c++) {
+		const uint32_t size = cases[c].size;
+
+		for (unsigned w = 0; w < 8; w++) {
+			const uint32_t start = (size - 32) / 7 * w;
+
+			assert(fp_spread(size, start, 32) >= cases[c].min_fp);
+		}
+	}
+}
+
 static void
 test_basic(void)
 {
@@ -43,13 +107,13 @@ test_basic(void)
 }
 
 static void
-test_large(void)
+test_large(unsigned flags)
 {
 	const unsigned nitems = 1024 * 1024;
 	rhashmap_t *hmap;
 	void *ret;
 
-	hmap = rhashmap_create(0, 0);
+	hmap = rhashmap_create(0, flags);
 	assert(hmap != NULL);
 
 	for (unsigned i = 0; i < nitems; i++) {
@@ -111,6 +175,355 @@ test_delete(void)
 	free(keys);
 }
 
+static void
+test_sizes(unsigned flags)
+{
+	/*
+	 * Small tables wrap around the control byte groups; exercise
+	 * a range of the minimum sizes with probe sequences crossing
+	 * the end of the table.
+	 */
+	for (unsigned size = 1; size < 80; size++) {
+		const unsigned nitems = size * 2;
+		rhashmap_t *hmap;
+		void *ret;
+
+		hmap = rhashmap_create(size, flags);
+		assert(hmap != NULL);
+
+		for (unsigned i = 0; i < nitems; i++) {
+			ret = rhashmap_put(hmap, &i, sizeof(int), NUM2PTR(i));
+			assert(ret == NUM2PTR(i));
+		}
+		for (unsigned i = 0; i < nitems * 2; i++) {
+			ret = rhashmap_get(hmap, &i, sizeof(int));
+			assert(ret == (i < nitems ? NUM2PTR(i) : NULL));
+		}
+		for (unsigned i = 0; i < nitems; i += 2) {
+			ret = rhashmap_del(hmap, &i, sizeof(int));
+			assert(ret == NUM2PTR(i));
+		}
+		for (unsigned i = 0; i < nitems; i++) {
+			ret = rhashmap_get(hmap, &i, sizeof(int));
+			assert(ret == ((i & 1) ? NUM2PTR(i) : NULL));
+		}
+		rhashmap_destroy(hmap);
+	}
+}
+
+static void
+test_keylen(unsigned flags)
+{
+	/*
+	 * Keys of all lengths around the inline/prefix limits, sharing
+	 * a long common prefix so that only their tails differ.
+	 */
+	const unsigned maxlen = 40, nkeys = 8;
+	unsigned char keys[maxlen + 1][nkeys][maxlen];
+	rhashmap_t *hmap;
+	void *ret;
+
+	hmap = rhashmap_create(0, flags);
+	assert(hmap != NULL);
+
+	memset(keys, 0xa5, sizeof(keys));
+	for (unsigned len = 1; len <= maxlen; len++) {
+		for (unsigned k = 0; k < nkeys; k++) {
+			keys[len][k][len - 1] = k;
+			ret = rhashmap_put(hmap, keys[len][k], len,
+			    NUM2PTR(len << 8 | k));
+			assert(ret == NUM2PTR(len << 8 | k));
+		}
+	}
+	for (unsigned len = 1; len <= maxlen; len++) {
+		for (unsigned k = 0; k < nkeys; k++) {
+			ret = rhashmap_get(hmap, keys[len][k], len);
+			assert(ret == NUM2PTR(len << 8 | k));
+		}
+	}
+	for (unsigned len = 1; len <= maxlen; len++) {
+		for (unsigned k = 0; k < nkeys; k++) {
+			ret = rhashmap_del(hmap, keys[len][k], len);
+			assert(ret == NUM2PTR(len << 8 | k));
+			ret = rhashmap_get(hmap, keys[len][k], len);
+			assert(ret == NULL);
+		}
+	}
+	rhashmap_destroy(hmap);
+}
+
+static void
+test_longkey(unsigned flags)
+{
+	/*
+	 * The keys longer than 64 KB are supported only by the wide maps.
+	 */
+	const size_t len = 70 * 1000;
+	const bool wide = (flags & RHM_WIDE) != 0;
+	unsigned char *key;
+	rhashmap_t *hmap;
+	void *ret;
+
+	key = malloc(len);
+	assert(key != NULL);
+	memset(key, 0x5a, len);
+
+	hmap = rhashmap_create(0, flags);
+	assert(hmap != NULL);
+
+	ret = rhashmap_put(hmap, key, len, NUM2PTR(1));
+	assert(ret == (wide ? NUM2PTR(1) : NULL));
+	ret = rhashmap_put(hmap, key, len - 1, NUM2PTR(2));
+	assert(ret == (wide ? NUM2PTR(2) : NULL));
+
+	ret = rhashmap_get(hmap, key, len);
+	assert(ret == (wide ? NUM2PTR(1) : NULL));
+	ret = rhashmap_del(hmap, key, len);
+	assert(ret == (wide ? NUM2PTR(1) : NULL));
+	ret = rhashmap_get(hmap, key, len - 1);
+	assert(ret == (wide ? NUM2PTR(2) : NULL));
+
+	rhashmap_destroy(hmap);
+	free(key);
+}
+
+static void
+test_u64(void)
+{
+	const unsigned nitems = 100 * 1000;
+	uint64_t bitmap[2] = { 0, 0 };
+	rhashmap_t *hmap;
+	uintmax_t iter;
+	size_t klen;
+	void *ret, *key, *val;
+
+	hmap = rhashmap_u64_create(0, RHM_NOCOPY);
+	assert(hmap != NULL);
+
+	ret = rhashmap_u64_get(hmap, 0);
+	assert(ret == NULL);
+
+	for (unsigned i = 0; i < nitems; i++) {
+		const uint64_t k = (uint64_t)i * 0x9e3779b97f4a7c15ULL;
+
+		ret = rhashmap_u64_put(hmap, k, NUM2PTR(i + 1));
+		assert(ret == NUM2PTR(i + 1));
+		ret = rhashmap_u64_put(hmap, k, NUM2PTR(i + 2));
+		assert(ret == NUM2PTR(i + 1));
+	}
+	ret = rhashmap_u64_put(hmap, UINT64_MAX, NUM2PTR(0x55));
+	assert(ret == NUM2PTR(0x55));
+
+	for (unsigned i = 0; i < nitems; i++) {
+		const uint64_t k = (uint64_t)i * 0x9e3779b97f4a7c15ULL;
+
+		ret = rhashmap_u64_get(hmap, k);
+		assert(ret == NUM2PTR(i + 1));
+		ret = rhashmap_u64_get(hmap, k + 1);
+		assert(ret == NULL);
+	}
+
+	/* Delete all but the first few keys; then walk the rest. */
+	for (unsigned i = 64; i < nitems; i++) {
+		const uint64_t k = (uint64_t)i * 0x9e3779b97f4a7c15ULL;
+
+		ret = rhashmap_u64_del(hmap, k);
+		assert(ret == NUM2PTR(i + 1));
+		ret = rhashmap_u64_get(hmap, k);
+		assert(ret == NULL);
+	}
+	ret = rhashmap_u64_del(hmap, UINT64_MAX);
+	assert(ret == NUM2PTR(0x55));
+
+	iter = RHM_WALK_BEGIN;
+	while ((key = rhashmap_walk(hmap, &iter, &klen, &val)) != NULL) {
+		const unsigned i = (uintptr_t)val - 1;
+		uint64_t k;
+
+		assert(klen == sizeof(uint64_t));
+		memcpy(&k, key, sizeof(k));
+		assert(k == (uint64_t)i * 0x9e3779b97f4a7c15ULL);
+		bitmap[i / 64] |= 1ULL << (i % 64);
+	}
+	assert(bitmap[0] == UINT64_MAX && bitmap[1] == 0);
+
+	rhashmap_destroy(hmap);
+}
+
+static void
+test_set(bool u64)
+{
+	const unsigned nitems = 50 * 1000;
+	rhashset_t *hset;
+	uintmax_t iter;
+	unsigned n = 0;
+	size_t klen;
+	void *key, *val;
+	int ret;
+
+	hset = u64 ? rhashset_u64_create(0, 0) : rhashset_create(0, 0);
+	assert(hset != NULL);
+
+	for (uint64_t i = 0; i < nitems; i++) {
+		ret = u64 ? rhashset_u64_add(hset, i) :
+		    rhashset_add(hset, &i, sizeof(i));
+		assert(ret == 1);
+		ret = u64 ? rhashset_u64_add(hset, i) :
+		    rhashset_add(hset, &i, sizeof(i));
+		assert(ret == 0);
+	}
+	for (uint64_t i = 0; i < nitems * 2; i++) {
+		ret = u64 ? rhashset_u64_has(hset, i) :
+		    rhashset_has(hset, &i, sizeof(i));
+		assert(ret == (i < nitems));
+	}
+	for (uint64_t i = 0; i < nitems; i += 2) {
+		ret = u64 ? rhashset_u64_del(hset, i) :
+		    rhashset_del(hset, &i, sizeof(i));
+		assert(ret == 1);
+		ret = u64 ? rhashset_u64_del(hset, i) :
+		    rhashset_del(hset, &i, sizeof(i));
+		assert(ret == 0);
+	}
+
+	iter = RHM_WALK_BEGIN;
+	while ((key = rhashmap_walk(hset, &iter, &klen, &val)) != NULL) {
+		uint64_t k;
+
+		assert(klen == sizeof(uint64_t) && val == NULL);
+		memcpy(&k, key, sizeof(k));
+		assert(k < nitems && (k & 1) != 0);
+		n++;
+	}
+	assert(n == nitems / 2);
+
+	rhashset_destroy(hset);
+}
+
+/*
+ * test_set_keylen: the sets keep the keys of up to eight bytes in the
+ * bucket and the longer ones by pointer (without a prefix); the keys
+ * differ only in the last byte, so each compare must check all bytes.
+ */
+static void
+test_set_keylen(unsigned flags)
+{
+	const unsigned nkeys = 2000, maxlen = 40;
+	uint8_t key[40];
+	rhashset_t *hset;
+	uintmax_t iter;
+	unsigned n = 0;
+	size_t klen;
+	void *k, *val;
+
+	hset = rhashset_create(0, flags);
+	assert(hset != NULL);
+
+	memset(key, 'k', sizeof(key));
+	for (unsigned len = 2; len <= maxlen; len++) {
+		for (unsigned i = 0; i < nkeys; i += 2) {
+			key[len - 2] = (uint8_t)(i >> 8);
+			key[len - 1] = (uint8_t)i;
+			assert(rhashset_add(hset, key, len) == 1);
+		}
+		key[len - 2] = key[len - 1] = 'k';
+	}
+	for (unsigned len = 2; len <= maxlen; len++) {
+		for (unsigned i = 0; i < nkeys; i++) {
+			key[len - 2] = (uint8_t)(i >> 8);
+			key[len - 1] = (uint8_t)i;
+			assert(rhashset_has(hset, key, len) == ((i & 1) == 0));
+		}
+		key[len - 2] = key[len - 1] = 'k';
+	}
+
+	iter = RHM_WALK_BEGIN;
+	while ((k = rhashmap_walk(hset, &iter, &klen, &val)) != NULL) {
+		const uint8_t *p = k;
+
+		assert(klen >= 2 && klen <= maxlen && val == NULL);
+		assert(klen == 2 || p[klen - 3] == 'k');
+		assert((p[klen - 1] & 1) == 0);
+		n++;
+	}
+	assert(n == (maxlen - 1) * nkeys / 2);
+
+	for (unsigned len = 2; len <= maxlen; len++) {
+		for (unsigned i = 0; i < nkeys; i += 2) {
+			key[len - 2] = (uint8_t)(i >> 8);
+			key[len - 1] = (uint8_t)i;
+			assert(rhashset_del(hset, key, len) == 1);
+		}
+		key[len - 2] = key[len - 1] = 'k';
+	}
+	rhashset_destroy(hset);
+}
+
+static void
+test_vals(void)
+{
+	struct val {
+		uint64_t	count;
+		uint32_t	id;
+	} *v, dv;
+	const rhashmap_params_t params = {
+		.flags = RHM_POW2, .valsize = sizeof(struct val)
+	};
+	const unsigned nitems = 50 * 1000;
+	rhashmap_t *hmap;
+	uintmax_t iter;
+	unsigned n = 0;
+	size_t klen;
+	void *key, *val;
+	int ret;
+
+	hmap = rhashmap_create_ex(&params);
+	assert(hmap != NULL);
+
+	for (unsigned i = 0; i < nitems; i++) {
+		const struct val init = { .count = 1, .id = i };
+
+		v = rhashmap_vput(hmap, &i, sizeof(i), &init);
+		assert(v != NULL && v->count == 1 && v->id == i);
+
+		/* Existing key: the value is not changed. */
+		v = rhashmap_vput(hmap, &i, sizeof(i), NULL);
+		assert(v != NULL && v->count == 1);
+		v->count++;
+	}
+	for (unsigned i = 0; i < nitems * 2; i++) {
+		v = rhashmap_vget(hmap, &i, sizeof(i));
+		assert(i < nitems ? (v->count == 2 && v->id == i) : !v);
+	}
+
+	/* New key without the value: zeroed. */
+	v = rhashmap_vput(hmap, &nitems, sizeof(nitems), NULL);
+	assert(v != NULL && v->count == 0 && v->id == 0);
+	ret = rhashmap_vdel(hmap, &nitems, sizeof(nitems), NULL);
+	assert(ret == 1);
+
+	for (unsigned i = 0; i < nitems; i += 2) {
+		ret = rhashmap_vdel(hmap, &i, sizeof(i), &dv);
+		assert(ret == 1 && dv.count == 2 && dv.id == i);
+		ret = rhashmap_vdel(hmap, &i, sizeof(i), &dv);
+		assert(ret == 0);
+	}
+
+	iter = RHM_WALK_BEGIN;
+	while ((key = rhashmap_walk(hmap, &iter, &klen, &val)) != NULL) {
+		unsigned k;
+
+		assert(klen == sizeof(k));
+		memcpy(&k, key, sizeof(k));
+		v = val;
+		assert(v->id == k && (k & 1) != 0);
+		n++;
+	}
+	assert(n == nitems / 2);
+
+	rhashmap_destroy(hmap);
+}
+
 static void *
 generate_unique_key(unsigned idx, int *rlen)
 {
@@ -223,14 +636,899 @@ test_walk(void)
 	rhashmap_destroy(hmap);
 }
 
+static void
+test_incremental(unsigned flags)
+{
+	/*
+	 * Interleave the walks, lookups and deletes with the incremental
+	 * resize; use the long (copied) keys to catch the leaks on destroy.
+	 */
+	const unsigned nitems = 5000;
+	uint8_t seen[nitems];
+	rhashmap_t *hmap;
+	char key[32];
+	void *ret, *val;
+	uintmax_t iter;
+	unsigned count;
+	size_t len;
+
+	hmap = rhashmap_create(0, RHM_INCREMENTAL | flags);
+	assert(hmap != NULL);
+
+	for (unsigned i = 0; i < nitems; i++) {
+		len = (size_t)snprintf(key, sizeof(key),
+		    "incremental-resize-key-%u", i);
+		ret = rhashmap_put(hmap, key, len, NUM2PTR(i + 1));
+		assert(ret == NUM2PTR(i + 1));
+
+		if (i % 3 == 0) {
+			/* Delete every third key, but keep the last one. */
+			ret = rhashmap_del(hmap, key, len);
+			assert(ret == NUM2PTR(i + 1));
+			ret = rhashmap_put(hmap, key, len, NUM2PTR(i + 1));
+			assert(ret == NUM2PTR(i + 1));
+		}
+		if (i % 97 != 0) {
+			continue;
+		}
+
+		memset(seen, 0, sizeof(seen));
+		iter = RHM_WALK_BEGIN, count = 0;
+		while (rhashmap_walk(hmap, &iter, &len, &val) != NULL) {
+			const uintptr_t n = (uintptr_t)val - 1;
+
+			assert(n <= i && !seen[n]);
+			seen[n] = 1, count++;
+		}
+		assert(count == i + 1);
+	}
+	for (unsigned i = 0; i < nitems; i++) {
+		len = (size_t)snprintf(key, sizeof(key),
+		    "incremental-resize-key-%u", i);
+		ret = rhashmap_get(hmap, key, len);
+		assert(ret == NUM2PTR(i + 1));
+	}
+	for (unsigned i = 0; i < nitems; i += 2) {
+		len = (size_t)snprintf(key, sizeof(key),
+		    "incremental-resize-key-%u", i);
+		ret = rhashmap_del(hmap, key, len);
+		assert(ret == NUM2PTR(i + 1));
+		ret = rhashmap_get(hmap, key, len);
+		assert(ret == NULL);
+	}
+	rhashmap_destroy(hmap);
+}
+
+static void
+test_policy(void)
+{
+	const rhashmap_params_t invalid[] = {
+		{ .growth = 100 },			// no growth
+		{ .max_load = 99 },			// too high
+		{ .max_load = 60, .min_load = 30 },	// shrink to 60%
+		{ .growth = 400, .min_load = 25 },	// grow to 21%
+	};
+	const rhashmap_params_t valid[] = {
+		{ .growth = 150 },
+		{ .growth = 400, .max_load = 95 },
+		{ .growth = 300, .growth_step = 4096, .max_load = 50 },
+		{ .flags = RHM_POW2, .growth = 150, .max_load = 70 },
+		{ .flags = RHM_INCREMENTAL, .growth = 125, .min_load = 30 },
+	};
+	const unsigned nitems = 100 * 1000;
+
+	for (unsigned i = 0; i < __arraycount(invalid); i++) {
+		assert(rhashmap_create_ex(&invalid[i]) == NULL);
+	}
+	for (unsigned p = 0; p < __arraycount(valid); p++) {
+		rhashmap_t *hmap;
+		void *ret;
+
+		hmap = rhashmap_create_ex(&valid[p]);
+		assert(hmap != NULL);
+
+		for (unsigned i = 0; i < nitems; i++) {
+			ret = rhashmap_put(hmap, &i, sizeof(int), NUM2PTR(i));
+			assert(ret == NUM2PTR(i));
+		}
+		for (unsigned i = 0; i < nitems; i++) {
+			ret = rhashmap_get(hmap, &i, sizeof(int));
+			assert(ret == NUM2PTR(i));
+		}
+		for (unsigned i = 0; i < nitems; i++) {
+			ret = rhashmap_del(hmap, &i, sizeof(int));
+			assert(ret == NUM2PTR(i));
+		}
+		rhashmap_destroy(hmap);
+	}
+}
+
+static void
+test_compact(unsigned flags, size_t shrink_delay)
+{
+	const rhashmap_params_t params = {
+		.flags = flags, .shrink_delay = shrink_delay
+	};
+	const unsigned nitems = 100 * 1000;
+	rhashmap_t *hmap;
+	void *ret;
+
+	hmap = rhashmap_create_ex(&params);
+	assert(hmap != NULL);
+
+	/* Empty: nothing to compact. */
+	assert(rhashmap_compact(hmap) == 0);
+
+	for (unsigned i = 0; i < nitems; i++) {
+		ret = rhashmap_put(hmap, &i, sizeof(int), NUM2PTR(i));
+		assert(ret == NUM2PTR(i));
+	}
+	for (unsigned i = 0; i < nitems; i++) {
+		if (i % 10) {
+			ret = rhashmap_del(hmap, &i, sizeof(int));
+			assert(ret == NUM2PTR(i));
+		}
+	}
+	assert(rhashmap_compact(hmap) == 0);
+	assert(rhashmap_compact(hmap) == 0);
+
+	for (unsigned i = 0; i < nitems; i++) {
+		ret = rhashmap_get(hmap, &i, sizeof(int));
+		assert(ret == ((i % 10) ? NULL : NUM2PTR(i)));
+	}
+	for (unsigned i = 0; i < nitems; i++) {
+		ret = rhashmap_put(hmap, &i, sizeof(int), NUM2PTR(i));
+		assert(ret == NUM2PTR(i));
+	}
+	for (unsigned i = 0; i < nitems; i++) {
+		ret = rhashmap_del(hmap, &i, sizeof(int));
+		assert(ret == NUM2PTR(i));
+	}
+	assert(rhashmap_compact(hmap) == 0);
+	rhashmap_destroy(hmap);
+}
+
+static void
+test_reserve(unsigned flags)
+{
+	const unsigned nitems = 100 * 1000;
+	rhashmap_t *hmap;
+	void *ret;
+
+	hmap = rhashmap_create(0, flags);
+	assert(hmap != NULL);
+
+	assert(rhashmap_reserve(hmap, nitems) == 0);
+	assert(rhashmap_reserve(hmap, nitems / 2) == 0);
+	assert(rhashmap_reserve(hmap, SIZE_MAX) == -1);
+	/* Fewer items than the maximum buckets, but not at the max load. */
+	assert(rhashmap_reserve(hmap, (size_t)3 << 56) == -1);
+
+	for (unsigned i = 0; i < nitems; i++) {
+		ret = rhashmap_put(hmap, &i, sizeof(int), NUM2PTR(i));
+		assert(ret == NUM2PTR(i));
+	}
+	for (unsigned i = 0; i < nitems; i++) {
+		ret = rhashmap_get(hmap, &i, sizeof(int));
+		assert(ret == NUM2PTR(i));
+	}
+
+	/* Reserve with the items present, then shrink back. */
+	assert(rhashmap_reserve(hmap, 4 * nitems) == 0);
+	for (unsigned i = 0; i < nitems; i++) {
+		ret = rhashmap_del(hmap, &i, sizeof(int));
+		assert(ret == NUM2PTR(i));
+	}
+	rhashmap_destroy(hmap);
+}
+
+static void
+test_lazy(void)
+{
+	const rhashmap_params_t params = { .valsize = 12 };
+	rhashmap_t *hmap, *vmap, *umap;
+	rhashset_t *hset;
+	uintmax_t iter = RHM_WALK_BEGIN;
+	uint64_t key = 1;
+
+	/* The operations on the maps which were never inserted into. */
+	hmap = rhashmap_create(0, 0);
+	vmap = rhashmap_create_ex(&params);
+	umap = rhashmap_u64_create(0, RHM_POW2);
+	hset = rhashset_create(1000, 0);
+	assert(hmap && vmap && umap && hset);
+
+	assert(rhashmap_get(hmap, &key, sizeof(key)) == NULL);
+	assert(rhashmap_del(hmap, &key, sizeof(key)) == NULL);
+	assert(rhashmap_walk(hmap, &iter, NULL, NULL) == NULL);
+	assert(rhashmap_compact(hmap) == 0);
+	assert(rhashmap_vget(vmap, &key, sizeof(key)) == NULL);
+	assert(rhashmap_vdel(vmap, &key, sizeof(key), NULL) == 0);
+	assert(rhashmap_u64_get(umap, key) == NULL);
+	assert(rhashmap_u64_del(umap, key) == NULL);
+	assert(rhashset_has(hset, &key, sizeof(key)) == 0);
+	assert(rhashset_del(hset, &key, sizeof(key)) == 0);
+
+	/* The first insert allocates. */
+	assert(rhashmap_put(hmap, &key, sizeof(key), NUM2PTR(1)) ==
+	    NUM2PTR(1));
+	assert(rhashmap_get(hmap, &key, sizeof(key)) == NUM2PTR(1));
+	assert(rhashmap_vput(vmap, &key, sizeof(key), NULL) != NULL);
+	assert(rhashmap_vget(vmap, &key, sizeof(key)) != NULL);
+	assert(rhashmap_u64_put(umap, key, NUM2PTR(1)) == NUM2PTR(1));
+	assert(rhashmap_u64_get(umap, key) == NUM2PTR(1));
+	assert(rhashset_add(hset, &key, sizeof(key)) == 1);
+	assert(rhashset_has(hset, &key, sizeof(key)) == 1);
+
+	rhashmap_destroy(hmap);
+	rhashmap_destroy(vmap);
+	rhashmap_destroy(umap);
+	rhashset_destroy(hset);
+
+	/* Reserve before the first insert. */
+	hmap = rhashmap_create(0, RHM_WIDE);
+	assert(hmap != NULL);
+	assert(rhashmap_reserve(hmap, 1000) == 0);
+	for (unsigned i = 0; i < 1000; i++) {
+		assert(rhashmap_put(hmap, &i, sizeof(i), NUM2PTR(i)) ==
+		    NUM2PTR(i));
+	}
+	rhashmap_destroy(hmap);
+
+	/* Destroy without ever inserting. */
+	rhashmap_destroy(rhashmap_create(0, RHM_INCREMENTAL));
+	rhashset_destroy(rhashset_u64_create(0, 0));
+}
+
+static void
+test_parallel(unsigned flags)
+{
+	const rhashmap_params_t invalid = { .resize_threads = 65 };
+	const rhashmap_params_t params = {
+		.flags = flags, .max_load = 95, .resize_threads = 4
+	};
+	const unsigned nitems = 1024 * 1024;
+	rhashmap_t *hmap;
+	void *ret;
+
+	assert(rhashmap_create_ex(&invalid) == NULL);
+
+	hmap = rhashmap_create_ex(&params);
+	assert(hmap != NULL);
+
+	/* Grow (and then shrink) through the parallel resizes. */
+	for (unsigned i = 0; i < nitems; i++) {
+		ret = rhashmap_put(hmap, &i, sizeof(int), NUM2PTR(i));
+		assert(ret == NUM2PTR(i));
+	}
+	assert(rhashmap_reserve(hmap, 3 * nitems) == 0);
+	for (unsigned i = 0; i < nitems; i++) {
+		ret = rhashmap_get(hmap, &i, sizeof(int));
+		assert(ret == NUM2PTR(i));
+	}
+	for (unsigned i = 0; i < nitems; i++) {
+		ret = rhashmap_del(hmap, &i, sizeof(int));
+		assert(ret == NUM2PTR(i));
+		if ((i & 0xffff) == 0) {
+			for (unsigned j = i + 1; j < nitems; j += 997) {
+				ret = rhashmap_get(hmap, &j, sizeof(int));
+				assert(ret == NUM2PTR(j));
+			}
+		}
+	}
+	rhashmap_destroy(hmap);
+}
+
+static void
+test_background(unsigned flags)
+{
+	/*
+	 * Delete and re-insert the older keys (likely in the old table)
+	 * while the new table is built in the background; walk and check
+	 * the contents against the expected state.
+	 */
+	const unsigned nitems = 20 * 1000;
+	uint8_t *present, *seen;
+	rhashmap_t *hmap;
+	char key[32];
+	void *ret, *val;
+	uintmax_t iter;
+	unsigned count, n = 0;
+	size_t len;
+
+	present = calloc(nitems, 1);
+	seen = calloc(nitems, 1);
+	assert(present && seen);
+
+	hmap = rhashmap_create(0, RHM_BACKGROUND | flags);
+	assert(hmap != NULL);
+
+	for (unsigned i = 0; i < nitems; i++) {
+		const unsigned k = i / 2;
+
+		len = (size_t)snprintf(key, sizeof(key), "bg-key-%u", i);
+		ret = rhashmap_put(hmap, key, len, NUM2PTR(i + 1));
+		assert(ret == NUM2PTR(i + 1));
+		present[i] = 1, n++;
+
+		len = (size_t)snprintf(key, sizeof(key), "bg-key-%u", k);
+		if (i % 5 == 0) {
+			ret = rhashmap_del(hmap, key, len);
+			assert(ret == (present[k] ? NUM2PTR(k + 1) : NULL));
+			n -= present[k], present[k] = 0;
+			assert(rhashmap_get(hmap, key, len) == NULL);
+		}
+		if (i % 10 == 5) {
+			ret = rhashmap_put(hmap, key, len, NUM2PTR(k + 1));
+			assert(ret == NUM2PTR(k + 1));
+			n += !present[k], present[k] = 1;
+		}
+		if (i % 501 != 0) {
+			continue;
+		}
+
+		memset(seen, 0, nitems);
+		iter = RHM_WALK_BEGIN, count = 0;
+		while (rhashmap_walk(hmap, &iter, &len, &val) != NULL) {
+			const uintptr_t v = (uintptr_t)val - 1;
+
+			assert(v <= i && present[v] && !seen[v]);
+			seen[v] = 1, count++;
+		}
+		assert(count == n);
+	}
+	for (unsigned i = 0; i < nitems; i++) {
+		len = (size_t)snprintf(key, sizeof(key), "bg-key-%u", i);
+		ret = rhashmap_get(hmap, key, len);
+		assert(ret == (present[i] ? NUM2PTR(i + 1) : NULL));
+	}
+	rhashmap_destroy(hmap);
+	free(present);
+	free(seen);
+}
+
+static void
+test_bg_replay(unsigned flags)
+{
+	/*
+	 * Delete the keys (not inline) while the new table is built and
+	 * pause for the helper thread to complete, so that the deletes are
+	 * replayed incrementally while more keys are inserted and deleted.
+	 */
+	const unsigned nitems = 50 * 1000;
+	uint8_t *present;
+	rhashmap_t *hmap;
+	char key[64];
+	void *ret, *val;
+	uintmax_t iter;
+	unsigned count, n = 0;
+	size_t len;
+
+	present = calloc(nitems, 1);
+	assert(present);
+
+	hmap = rhashmap_create(0, RHM_BACKGROUND | flags);
+	assert(hmap != NULL);
+
+	for (unsigned i = 0; i < nitems; i++) {
+		const unsigned k = i / 2;
+
+		len = (size_t)snprintf(key, sizeof(key),
+		    "bg-replay-key-of-some-length-%u", i);
+		ret = rhashmap_put(hmap, key, len, NUM2PTR(i + 1));
+		assert(ret == NUM2PTR(i + 1));
+		present[i] = 1, n++;
+
+		if (i % 3 == 0) {
+			len = (size_t)snprintf(key, sizeof(key),
+			    "bg-replay-key-of-some-length-%u", k);
+			ret = rhashmap_del(hmap, key, len);
+			assert(ret == (present[k] ? NUM2PTR(k + 1) : NULL));
+			n -= present[k], present[k] = 0;
+		}
+		if (i % 1000 == 999) {
+			usleep(1000);
+		}
+	}
+	for (unsigned i = 0; i < nitems; i++) {
+		len = (size_t)snprintf(key, sizeof(key),
+		    "bg-replay-key-of-some-length-%u", i);
+		ret = rhashmap_get(hmap, key, len);
+		assert(ret == (present[i] ? NUM2PTR(i + 1) : NULL));
+	}
+	iter = RHM_WALK_BEGIN, count = 0;
+	while (rhashmap_walk(hmap, &iter, &len, &val) != NULL) {
+		assert(present[(uintptr_t)val - 1]);
+		count++;
+	}
+	assert(count == n);
+	rhashmap_destroy(hmap);
+	free(present);
+}
+
+static void
+clear_cb(void *key, size_t len, void *val, void *arg)
+{
+	unsigned *count = arg;
+
+	assert(len == sizeof(unsigned) || len == 32);
+	assert(val == NUM2PTR(1));
+	(void)key;
+	(*count)++;
+}
+
+static void
+test_clear(unsigned flags)
+{
+	const unsigned nitems = 100 * 1000;
+	char longkey[32];
+	rhashmap_t *hmap;
+	unsigned *keys, count;
+	void *ret;
+
+	/* Note: the keys must stay valid in the RHM_NOCOPY mode. */
+	keys = malloc(nitems * sizeof(unsigned));
+	assert(keys != NULL);
+	for (unsigned i = 0; i < nitems; i++) {
+		keys[i] = i;
+	}
+
+	hmap = rhashmap_create(0, flags);
+	assert(hmap != NULL);
+
+	/* Clear the map which was never inserted into. */
+	count = 0;
+	rhashmap_clear(hmap, clear_cb, &count);
+	assert(count == 0);
+
+	/* Two batches: the second one reuses the buckets. */
+	for (unsigned batch = 0; batch < 2; batch++) {
+		for (unsigned i = 0; i < nitems; i++) {
+			ret = rhashmap_put(hmap, &keys[i], sizeof(int),
+			    NUM2PTR(1));
+			assert(ret == NUM2PTR(1));
+		}
+		memset(longkey, 'k', sizeof(longkey));
+		if ((flags & RHM_NOCOPY) == 0) {
+			ret = rhashmap_put(hmap, longkey, sizeof(longkey),
+			    NUM2PTR(1));
+			assert(ret == NUM2PTR(1));
+		}
+
+		count = 0;
+		rhashmap_clear(hmap, clear_cb, &count);
+		assert(count == nitems + ((flags & RHM_NOCOPY) == 0));
+		for (unsigned i = 0; i < nitems; i += 97) {
+			ret = rhashmap_get(hmap, &i, sizeof(int));
+			assert(ret == NULL);
+		}
+		assert(rhashmap_get(hmap, longkey, sizeof(longkey)) == NULL);
+	}
+
+	/* Without a callback: the key copies are freed. */
+	for (unsigned i = 0; i < 1000; i++) {
+		ret = rhashmap_put(hmap, &keys[i], sizeof(int), NUM2PTR(1));
+		assert(ret == NUM2PTR(1));
+	}
+	rhashmap_clear(hmap, NULL, NULL);
+	assert(rhashmap_del(hmap, &keys[0], sizeof(int)) == NULL);
+	rhashmap_destroy(hmap);
+	free(keys);
+}
+
+static size_t
+arena_key(unsigned char *key, unsigned i, unsigned seq)
+{
+	/* From 17 bytes (not inline) to above the arena key size. */
+	const size_t len = 17 + (i + seq) % 284;
+
+	memset(key, (int)(i + seq), len);
+	memcpy(key, &i, sizeof(i));
+	return len;
+}
+
+static void
+test_arena(unsigned flags)
+{
+	/*
+	 * The key copies of all sizes in the key arena (and above it),
+	 * with churn, so that the freed space is reused.
+	 */
+	const unsigned nitems = 20 * 1000;
+	unsigned char key[300];
+	rhashmap_t *hmap;
+	void *ret;
+	size_t len;
+
+	hmap = rhashmap_create(0, flags);
+	assert(hmap != NULL);
+
+	for (unsigned seq = 0; seq < 2; seq++) {
+		for (unsigned i = 0; i < nitems; i++) {
+			len = arena_key(key, i, seq);
+			ret = rhashmap_put(hmap, key, len, NUM2PTR(i + 1));
+			assert(ret == NUM2PTR(i + 1));
+		}
+		for (unsigned i = seq; i < nitems; i += 2) {
+			len = arena_key(key, i, seq);
+			ret = rhashmap_del(hmap, key, len);
+			assert(ret == NUM2PTR(i + 1));
+		}
+		for (unsigned i = 0; i < nitems; i++) {
+			len = arena_key(key, i, seq);
+			ret = rhashmap_del(hmap, key, len);
+			assert(ret == ((i % 2) == seq ? NULL : NUM2PTR(i + 1)));
+		}
+	}
+
+	/* Clear and destroy with the keys present. */
+	for (unsigned i = 0; i < nitems; i++) {
+		len = arena_key(key, i, 0);
+		ret = rhashmap_put(hmap, key, len, NUM2PTR(i + 1));
+		assert(ret == NUM2PTR(i + 1));
+	}
+	rhashmap_clear(hmap, NULL, NULL);
+	for (unsigned i = 0; i < nitems; i++) {
+		len = arena_key(key, i, 0);
+		assert(rhashmap_get(hmap, key, len) == NULL);
+		ret = rhashmap_put(hmap, key, len, NUM2PTR(i + 1));
+		assert(ret == NUM2PTR(i + 1));
+	}
+	for (unsigned i = 0; i < nitems; i++) {
+		len = arena_key(key, i, 0);
+		assert(rhashmap_get(hmap, key, len) == NUM2PTR(i + 1));
+	}
+	rhashmap_destroy(hmap);
+}
+
+/*
+ * A counting allocator: it keeps the length of each block in a header,
+ * to check the lengths passed to free.  Note: the background resize
+ * allocates in the helper thread.
+ */
+typedef struct {
+	atomic_size_t	nbytes;
+	atomic_uint	nblocks;
+	atomic_uint	nhuge;
+} test_alloc_t;
+
+#define	TEST_HDR_LEN	16
+
+static void *
+test_alloc(size_t len, void *arg)
+{
+	test_alloc_t *ta = arg;
+	uint8_t *p;
+
+	if ((p = malloc(TEST_HDR_LEN + len)) == NULL) {
+		return NULL;
+	}
+	memcpy(p, &len, sizeof(len));
+	atomic_fetch_add(&ta->nbytes, len);
+	atomic_fetch_add(&ta->nblocks, 1);
+	return p + TEST_HDR_LEN;
+}
+
+static void *
+test_zalloc(size_t len, void *arg)
+{
+	void *p;
+
+	if ((p = test_alloc(len, arg)) != NULL) {
+		memset(p, 0, len);
+	}
+	return p;
+}
+
+static void
+test_free(void *ptr, size_t len, void *arg)
+{
+	test_alloc_t *ta = arg;
+	uint8_t *p = (uint8_t *)ptr - TEST_HDR_LEN;
+	size_t blen, nbytes;
+	unsigned nblocks;
+
+	memcpy(&blen, p, sizeof(blen));
+	assert(blen == len);
+	nbytes = atomic_fetch_sub(&ta->nbytes, len);
+	nblocks = atomic_fetch_sub(&ta->nblocks, 1);
+	assert(nbytes >= len && nblocks > 0);
+	free(p);
+}
+
+static void *
+test_realloc(void *ptr, size_t oldlen, size_t len, void *arg)
+{
+	void *p;
+
+	if ((p = test_alloc(len, arg)) != NULL) {
+		memcpy(p, ptr, oldlen < len ? oldlen : len);
+		test_free(ptr, oldlen, arg);
+	}
+	return p;
+}
+
+static void
+test_hugepage(void *ptr, size_t len, void *arg)
+{
+	test_alloc_t *ta = arg;
+
+	assert(ptr != NULL && len >= 2 * 1024 * 1024);
+	atomic_fetch_add(&ta->nhuge, 1);
+}
+
+static void
+test_allocator(unsigned flags, bool with_realloc)
+{
+	const unsigned nitems = 300 * 1000;
+	test_alloc_t ta;
+	const rhashmap_allocator_t invalid = { .alloc = test_alloc };
+	const rhashmap_allocator_t allocator = {
+		.alloc = test_alloc, .zalloc = test_zalloc,
+		.free = test_free, .hugepage = test_hugepage,
+		.realloc = with_realloc ? test_realloc : NULL, .arg = &ta,
+	};
+	rhashmap_params_t params = {
+		.flags = flags, .resize_threads = 2, .allocator = &invalid
+	};
+	unsigned char key[300];
+	rhashmap_t *hmap;
+	void *ret;
+
+	atomic_init(&ta.nbytes, 0);
+	atomic_init(&ta.nblocks, 0);
+	atomic_init(&ta.nhuge, 0);
+	assert(rhashmap_create_ex(&params) == NULL);
+	params.allocator = &allocator;
+	hmap = rhashmap_create_ex(&params);
+	assert(hmap != NULL);
+	assert(ta.nblocks == 1);
+
+	for (unsigned i = 0; i < nitems; i++) {
+		const size_t len = arena_key(key, i, 0);
+
+		ret = rhashmap_put(hmap, key, len, NUM2PTR(i + 1));
+		assert(ret == NUM2PTR(i + 1));
+	}
+	for (unsigned i = 0; i < nitems; i += 2) {
+		const size_t len = arena_key(key, i, 0);
+
+		ret = rhashmap_del(hmap, key, len);
+		assert(ret == NUM2PTR(i + 1));
+	}
+	for (unsigned i = 0; i < nitems; i++) {
+		const size_t len = arena_key(key, i, 0);
+
+		ret = rhashmap_get(hmap, key, len);
+		assert(ret == (i % 2 ? NUM2PTR(i + 1) : NULL));
+	}
+	assert(ta.nhuge == 0 || (flags & RHM_HUGEPAGE) != 0);
+	assert(ta.nhuge != 0 || (flags & RHM_HUGEPAGE) == 0);
+
+	rhashmap_clear(hmap, NULL, NULL);
+	ret = rhashmap_put(hmap, key, 100, NUM2PTR(1));
+	assert(ret == NUM2PTR(1));
+
+	rhashmap_destroy(hmap);
+	assert(ta.nbytes == 0 && ta.nblocks == 0);
+}
+
+static void
+test_compact_keys(unsigned flags)
+{
+	const unsigned nitems = 100 * 1000;
+	test_alloc_t ta;
+	const rhashmap_allocator_t allocator = {
+		.alloc = test_alloc, .zalloc = test_zalloc,
+		.free = test_free, .arg = &ta,
+	};
+	const rhashmap_params_t params = {
+		.flags = flags, .allocator = &allocator
+	};
+	unsigned char key[300];
+	rhashmap_t *hmap;
+	size_t len, nbytes;
+	unsigned k = 0;
+	void *ret;
+	int error;
+
+	atomic_init(&ta.nbytes, 0);
+	atomic_init(&ta.nblocks, 0);
+	atomic_init(&ta.nhuge, 0);
+	hmap = rhashmap_create_ex(&params);
+	assert(hmap != NULL);
+	assert(rhashmap_compact_keys(hmap, 0) == 0);
+
+	/* Keep every fourth key. */
+	for (unsigned i = 0; i < nitems; i++) {
+		len = arena_key(key, i, 0);
+		ret = rhashmap_put(hmap, key, len, NUM2PTR(i + 1));
+		assert(ret == NUM2PTR(i + 1));
+	}
+	for (unsigned i = 0; i < nitems; i++) {
+		len = arena_key(key, i, 0);
+		if (i % 4) {
+			ret = rhashmap_del(hmap, key, len);
+			assert(ret == NUM2PTR(i + 1));
+		}
+	}
+	nbytes = atomic_load(&ta.nbytes);
+
+	/*
+	 * Compact in small steps, deleting and re-inserting the keys in
+	 * between, so that the entries move and the space is freed.
+	 */
+	do {
+		error = rhashmap_compact_keys(hmap, 500);
+		assert(error >= 0);
+
+		len = arena_key(key, k, 0);
+		ret = rhashmap_del(hmap, key, len);
+		assert(ret == NUM2PTR(k + 1));
+		ret = rhashmap_put(hmap, key, len, NUM2PTR(k + 1));
+		assert(ret == NUM2PTR(k + 1));
+		k = (k + 4) % nitems;
+	} while (error);
+	assert(atomic_load(&ta.nbytes) < nbytes);
+
+	for (unsigned i = 0; i < nitems; i++) {
+		len = arena_key(key, i, 0);
+		ret = rhashmap_get(hmap, key, len);
+		assert(ret == (i % 4 ? NULL : NUM2PTR(i + 1)));
+	}
+
+	/* In one go. */
+	assert(rhashmap_compact_keys(hmap, 0) == 0);
+	for (unsigned i = 0; i < nitems; i += 4) {
+		len = arena_key(key, i, 0);
+		ret = rhashmap_get(hmap, key, len);
+		assert(ret == NUM2PTR(i + 1));
+	}
+	rhashmap_destroy(hmap);
+	assert(atomic_load(&ta.nbytes) == 0);
+}
+
+static size_t
+intern_key(char *key, unsigned i)
+{
+	/* Unique keys, from 2 bytes to above the arena key size. */
+	const size_t pad = (i % 4) ? i % 17 : i % 280;
+	size_t len;
+
+	len = (size_t)snprintf(key, 16, "k%u", i);
+	memset(key + len, 'x', pad);
+	return len + pad;
+}
+
+static void
+test_intern(unsigned flags)
+{
+	const unsigned nitems = 50 * 1000;
+	const void **ptrs;
+	char key[300];
+	rhashset_t *hset;
+	const void *p;
+	size_t len;
+
+	assert(rhashmap_u64_create(0, RHM_INTERN) == NULL);
+	assert(rhashset_create(0, RHM_INTERN | RHM_NOCOPY) == NULL);
+
+	/* Not in the RHM_INTERN mode: nothing to return (nor insert). */
+	hset = rhashset_create(0, flags);
+	assert(hset != NULL);
+	assert(rhashmap_intern(hset, "key", 3) == NULL);
+	assert(rhashset_has(hset, "key", 3) == 0);
+	rhashset_destroy(hset);
+
+	ptrs = calloc(nitems, sizeof(void *));
+	assert(ptrs != NULL);
+
+	hset = rhashset_create(0, RHM_INTERN | flags);
+	assert(hset != NULL);
+
+	for (unsigned i = 0; i < nitems; i++) {
+		len = intern_key(key, i);
+		ptrs[i] = rhashmap_intern(hset, key, len);
+		assert(ptrs[i] != NULL && ptrs[i] != key);
+		assert(memcmp(ptrs[i], key, len) == 0);
+	}
+	assert(rhashmap_compact_keys(hset, 0) == 0);
+
+	/* The same pointers after the resizes. */
+	for (unsigned i = 0; i < nitems; i++) {
+		len = intern_key(key, i);
+		p = rhashmap_intern(hset, key, len);
+		assert(p == ptrs[i]);
+		if (i % 3 == 0) {
+			assert(rhashset_del(hset, key, len) == 1);
+		}
+	}
+	for (unsigned i = 0; i < nitems; i++) {
+		len = intern_key(key, i);
+		assert(rhashset_has(hset, key, len) == (i % 3 != 0));
+		if (i % 3 != 0) {
+			assert(rhashmap_intern(hset, key, len) == ptrs[i]);
+		}
+	}
+	rhashset_destroy(hset);
+	free(ptrs);
+}
+
 int
 main(void)
 {
+	test_fp_spread();
 	test_basic();
-	test_large();
+	test_large(0);
+	test_large(RHM_POW2);
+	test_large(RHM_HUGEPAGE);
+	test_large(RHM_WIDE);
+	test_large(RHM_WIDE | RHM_POW2 | RHM_NONCRYPTO);
+	test_large(RHM_INCREMENTAL);
 	test_delete();
+	test_sizes(0);
+	test_sizes(RHM_POW2);
+	test_sizes(RHM_WIDE);
+	test_sizes(RHM_WIDE | RHM_POW2);
+	test_sizes(RHM_INCREMENTAL);
+	test_sizes(RHM_INCREMENTAL | RHM_POW2);
+	test_keylen(0);
+	test_keylen(RHM_NOCOPY);
+	test_keylen(RHM_WIDE);
+	test_longkey(0);
+	test_longkey(RHM_WIDE);
 	test_random();
 	test_walk();
+	test_u64();
+	test_set(false);
+	test_set(true);
+	test_set_keylen(0);
+	test_set_keylen(RHM_INCREMENTAL | RHM_POW2);
+	test_set_keylen(RHM_WIDE);
+	test_vals();
+	test_incremental(0);
+	test_incremental(RHM_WIDE);
+	test_background(0);
+	test_background(RHM_POW2 | RHM_WIDE);
+	test_bg_replay(0);
+	test_bg_replay(RHM_POW2 | RHM_WIDE);
+	test_large(RHM_BACKGROUND);
+	test_policy();
+	test_compact(0, 0);
+	test_compact(RHM_NOSHRINK, 0);
+	test_compact(RHM_NOSHRINK | RHM_POW2, 0);
+	test_compact(RHM_INCREMENTAL, 0);
+	test_compact(0, 1000);
+	test_reserve(0);
+	test_reserve(RHM_POW2);
+	test_reserve(RHM_INCREMENTAL | RHM_WIDE);
+	test_lazy();
+	test_parallel(0);
+	test_parallel(RHM_POW2);
+	test_parallel(RHM_WIDE | RHM_NONCRYPTO);
+	test_parallel(RHM_BACKGROUND);
+	test_clear(0);
+	test_clear(RHM_NOCOPY);
+	test_clear(RHM_INCREMENTAL | RHM_WIDE);
+	test_clear(RHM_BACKGROUND | RHM_POW2);
+	test_arena(0);
+	test_arena(RHM_INCREMENTAL);
+	test_arena(RHM_BACKGROUND | RHM_WIDE);
+	test_allocator(0, true);
+	test_allocator(RHM_POW2 | RHM_HUGEPAGE, false);
+	test_allocator(RHM_INCREMENTAL, false);
+	test_allocator(RHM_BACKGROUND | RHM_POW2, true);
+	test_compact_keys(0);
+	test_compact_keys(RHM_INCREMENTAL);
+	test_compact_keys(RHM_BACKGROUND | RHM_NOSHRINK);
+	test_intern(0);
+	test_intern(RHM_POW2 | RHM_INCREMENTAL);
+	test_intern(RHM_BACKGROUND | RHM_WIDE);
+	test_large(RHM_NUMA);
+	test_large(RHM_NUMA | RHM_POW2);
+	test_large(RHM_NUMA | RHM_HUGEPAGE | RHM_INCREMENTAL);
+	test_clear(RHM_NUMA | RHM_POW2);
+	test_allocator(RHM_NUMA | RHM_POW2, true);
 	puts("ok");
 	return 0;
 }
@@ -44,6 +44,10 @@
 #define	MAX(x, y)	((x) > (y) ? (x) : (y))
 #endif
 
+#ifndef roundup2
+#define	roundup2(x, m)	(((x) + ((m) - 1)) & ~((__typeof__(x))(m) - 1))
+#endif
+
 /*
  * DSO visibility attributes (for ELF targets).
  */
@@ -78,7 +82,15 @@ fls(int x)
 }
 #endif
 
+static inline int
+fls64(uint64_t x)
+{
+	return x ? 64 - __builtin_clzll(x) : 0;
+}
+
 uint32_t	murmurhash3(const void *, size_t, uint32_t) __dso_hidden;
+uint64_t	murmurhash64a(const void *, size_t, uint64_t) __dso_hidden;
 uint32_t	halfsiphash(const uint8_t *, const size_t, const uint64_t) __dso_hidden;
+uint64_t	siphash24(const uint8_t *, const size_t, const uint64_t) __dso_hidden;
 
 #endif